@@ -20,6 +20,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "rusage.h"
 #include "proc.h"
 
 #define BACKSPACE 0x100
@@ -108,9 +109,15 @@ consoleread(int user_dst, uint64 dst, int n)
     }
 
     // copy the input byte to the user-space buffer.
+    // drop the lock meanwhile: the user page may have
+    // to be faulted in from disk.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    release(&cons.lock);
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      acquire(&cons.lock);
       break;
+    }
+    acquire(&cons.lock);
 
     dst++;
     --n;
@@ -2,11 +2,15 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct loadavg;
+struct memstat;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct shm;
 struct stat;
+struct vma;
 struct superblock;
 
 // bio.c
@@ -24,6 +28,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -61,8 +66,24 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+void*           kalloc_pages(int);
 void            kfree(void *);
+void            kfree_pages(void *, int);
+void            kref(void *);
+int             krefcnt(void *);
+int             kfreepages(void);
+void            kpgtype(void *, int);
+void            kmemstat(struct memstat*);
+int             kreclaim(void);
 void            kinit(void);
+void            kzerod(void);
+
+// kmalloc.c
+void*           kmalloc(uint);
+void            kmfree(void *);
+void            kmallocinit(void);
+int             kmalloc_drain(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -70,9 +91,19 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// pagecache.c
+void            pcacheinit(void);
+void*           pcacheget(struct inode*, uint, int);
+void            pcacheadd(struct inode*, uint, void*, int);
+void            pcacheupdate(struct inode*, uint, char*, uint);
+void            pcacheinval(struct inode*, uint, uint);
+int             pcacheshrink(void);
+int             pcachepages(void);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+int             pipecount(void);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
 
@@ -85,6 +116,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, struct file**);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -96,16 +128,23 @@ struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
 void            procinit(void);
+int             procshrink(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(char*, void (*)(void));
+int             oomkill(void);
 int             wait(uint64);
+int             wait4(int, uint64, uint64);
+int             getrusage(int, uint64);
 void            wakeup(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            calc_load(void);
+void            loadstat(struct loadavg*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -118,11 +157,30 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// shm.c
+void            shminit(void);
+int             shmopen(char*, int);
+int             shmunlink(char*);
+struct shm*     shmget(int, uint64*);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+void*           shmpage(struct shm*, int);
+
+// swap.c
+void            swapinit(void);
+int             swapout(void);
+int             swapin(pte_t*);
+void            swapdup(int);
+void            swapfree(int);
+void            kswapd(void);
+int             swapused(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            inheritprio(struct proc*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -158,18 +216,29 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+uint64          uvmsatp(struct proc*);
+void            asidinval(struct proc*);
+void            uwinclose(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
+void            uvmstrip(pagetable_t, uint64);
+int             kvmstack(uint64);
+void            kvmstackfence(void);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
-void            uvmclear(pagetable_t, uint64);
+int             uvmdiscard(pagetable_t, uint64, uint64);
+int             vmfault(pagetable_t, uint64, int);
+void*           uvmkalloc(int);
+void            uvmflush(struct proc*, uint64);
+pte_t*          uvmclock(struct proc*);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
+pte_t *         walkleaf(pagetable_t, uint64, int*);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
@@ -180,9 +249,22 @@ void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
 
+// vma.c
+struct vma*     vmalookup(struct proc*, uint64);
+uint64          vmabase(struct proc*);
+int             vmacopy(struct proc*, struct proc*);
+void            vmaclear(pagetable_t, struct vma*);
+void            vmatrim(struct proc*, uint64);
+uint64          mmap(uint64, int, int, struct inode*, uint);
+int             munmap(uint64, uint64);
+int             madvise(uint64, uint64, int);
+uint64          shmmap(int);
+int             vmafault(struct vma*, uint64, int);
+
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwpage(uint, void *, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -3,12 +3,11 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
-
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -19,8 +18,12 @@ int flags2perm(int flags)
     return perm;
 }
 
+// Replace p's user memory with the program at path, and set p
+// up to run it with arguments argv. p is the current process, or
+// a new one that spawn() has not yet let run.
+// Returns argc, or -1 with p untouched.
 int
-exec(char *path, char **argv)
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -28,8 +31,10 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v = vma;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+
+  memset(vma, 0, sizeof(vma));
 
   begin_op();
 
@@ -49,7 +54,8 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Describe each segment with a vma; vmfault() reads its
+  // pages from the file when the program first touches them.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,29 +67,42 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz >= TRAPFRAME)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.off + ph.filesz < ph.off)
       goto bad;
+    if(v == vma + NVMA)
+      goto bad;
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->prot = PTE_R | flags2perm(ph.flags);
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    sz = v->end;
+    v++;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible as a stack guard.
-  // Use the second as the user stack.
+  // Use the two pages at the next page boundary as a stack
+  // guard and the user stack. The guard is a region that can't
+  // be faulted in, so it stays unmapped, out of reach even of
+  // the kernel's direct user accesses.
   sz = PGROUNDUP(sz);
   uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE, PTE_W)) == 0)
+  if(v == vma + NVMA)
+    goto bad;
+  v->start = sz;
+  v->end = sz + PGSIZE;
+  v->prot = 0;
+  v++;
+  if((sz1 = uvmalloc(pagetable, sz + PGSIZE, sz + 2*PGSIZE, PTE_W)) == 0)
     goto bad;
   sz = sz1;
-  uvmclear(pagetable, sz-2*PGSIZE);
   sp = sz;
   stackbase = sp - PGSIZE;
 
@@ -123,9 +142,16 @@ exec(char *path, char **argv)
   // Commit to the user image.
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  asidinval(p);   // the TLB entries of p's ASID are for oldpagetable
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  for(i = 0; i < NVMA; i++){
+    struct vma tmp = p->vma[i];
+    p->vma[i] = vma[i];
+    vma[i] = tmp;
+  }
+  vmaclear(oldpagetable, vma);
   proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
@@ -137,30 +163,12 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  vmaclear(0, vma);
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+int
+exec(char *path, char **argv)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
+  return execproc(myproc(), path, argv);
 }
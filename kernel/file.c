@@ -11,12 +11,13 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "rusage.h"
 #include "proc.h"
 
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  int nfile;    // files open system-wide, at most NFILE
 } ftable;
 
 void
@@ -32,15 +33,22 @@ filealloc(void)
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.nfile >= NFILE){
+    release(&ftable.lock);
+    return 0;
   }
+  ftable.nfile++;
   release(&ftable.lock);
-  return 0;
+
+  if((f = kmalloc(sizeof(struct file))) == 0){
+    acquire(&ftable.lock);
+    ftable.nfile--;
+    release(&ftable.lock);
+    return 0;
+  }
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +77,9 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
+  ftable.nfile--;
   release(&ftable.lock);
+  kmfree(f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -103,10 +111,15 @@ filestat(struct file *f, uint64 addr)
 
 // Read from file f.
 // addr is a user virtual address.
+// An inode's data goes through a kernel page, a chunk at a time,
+// so that copyout() never runs with the inode locked: it may
+// fault in a page of an mmap()ed or executable file, and
+// vmafault() would have to lock that inode too.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
   int r = 0;
+  char *buf;
 
   if(f->readable == 0)
     return -1;
@@ -118,10 +131,29 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    if((buf = kalloc()) == 0)
+      return -1;
+    while(r < n){
+      int n1 = n - r, m;
+      if(n1 > PGSIZE)
+        n1 = PGSIZE;
+
+      ilock(f->ip);
+      if((m = readi(f->ip, 0, (uint64)buf, f->off, n1)) > 0)
+        f->off += m;
+      iunlock(f->ip);
+
+      if(m > 0 && copyout(myproc()->pagetable, addr + r, buf, m) < 0)
+        m = -1;
+      if(m < 0 && r == 0)
+        r = -1;
+      if(m <= 0)
+        break;
+      r += m;
+      if(m < n1)
+        break;
+    }
+    kfree(buf);
   } else {
     panic("fileread");
   }
@@ -131,10 +163,13 @@ fileread(struct file *f, uint64 addr, int n)
 
 // Write to file f.
 // addr is a user virtual address.
+// Like fileread(), copies through a kernel page before it locks
+// the inode, and before it starts a file system transaction.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
   int r, ret = 0;
+  char *buf;
 
   if(f->writable == 0)
     return -1;
@@ -154,14 +189,20 @@ filewrite(struct file *f, uint64 addr, int n)
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
+    if(max > PGSIZE)
+      max = PGSIZE;
+    if((buf = kalloc()) == 0)
+      return -1;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
+      if(copyin(myproc()->pagetable, buf, addr + i, n1) < 0)
+        break;
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      if ((r = writei(f->ip, 0, (uint64)buf, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
@@ -172,6 +213,7 @@ filewrite(struct file *f, uint64 addr, int n)
       }
       i += r;
     }
+    kfree(buf);
     ret = (i == n ? n : -1);
   } else {
     panic("filewrite");
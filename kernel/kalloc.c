@@ -1,6 +1,37 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// and physically contiguous runs of 2^order pages.
+//
+// Free memory is kept by a binary buddy allocator: a free block
+// of 2^order pages starts on a 2^order page boundary (counting
+// from KERNBASE), and when it and its buddy are both free they
+// coalesce into one block of order+1.
+//
+// Each CPU keeps its own list of free pages, so that kalloc()
+// and kfree() usually take only an uncontended per-CPU lock.
+// Pages move between the CPU lists and the buddy allocator in
+// batches of PCP_BATCH; a CPU that finds both its list and the
+// buddy allocator empty steals half of another CPU's list.
+//
+// The kzerod kernel thread keeps a pool of pages that are already
+// zeroed, for kalloc_zeroed(). Pages are only filled with junk
+// when the kernel is built with KALLOC_DEBUG.
+//
+// The allocator keeps count of its free pages. When that falls
+// below WMARK_LOW, the kswapd kernel thread (swap.c) reclaims
+// pages from the caches and swaps pages out, and user memory may
+// not use the last WMARK_MIN pages, which are kept for page
+// tables, pipes and the like (see uvmkalloc() in vm.c).
+//
+// Every allocated page has a reference count, so that page tables
+// can share it after a copy-on-write fork. kalloc() returns a page
+// with one reference, kref() adds one, and kfree() drops one and
+// frees the page only when none are left.
+//
+// Every allocated page also has a type, MEM_OTHER until its caller
+// says otherwise with kpgtype(), and each CPU counts the pages of
+// each type that it allocates and frees, for memstat().
 
 #include "types.h"
 #include "param.h"
@@ -8,6 +39,18 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "memstat.h"
+
+#define PCP_BATCH 16  // pages moved to or from the global pool at once
+#define PCP_HIGH  64  // a CPU list longer than this drains to the pool
+
+#define ZPOOL_HIGH 128 // kzerod stops zeroing when the pool is this big
+
+#define MAXORDER 10    // largest block is 2^MAXORDER pages (4 MB)
+
+#define NPAGES   ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PGINDEX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PG_FREE  0x80  // in buddy.order[]: head of a free block
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -16,27 +59,150 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;  // only used on the buddy free lists
 };
 
+// the buddy allocator. order[i] is PG_FREE|k if page i starts
+// a free block of 2^k pages, and 0 otherwise.
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER+1];
+  uchar order[NPAGES];
 } kmem;
 
+// reference counts of allocated pages, by PGINDEX.
+// updated with atomic instructions rather than a lock.
+int pgref[NPAGES];
+
+// MEM_* type of each allocated page, by PGINDEX.
+uchar pgtype[NPAGES];
+
+// free pages, counting the per-CPU lists and the zeroed pool.
+// updated with atomic instructions rather than a lock.
+int nfreepg;
+int ntotalpg;
+
+// per-CPU free lists and page counts.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  // pages of each type allocated on this CPU less those freed
+  // on it, which may be negative. only this CPU writes them.
+  int used[NMEMTYPE];
+} kcpu[NCPU];
+
+// pages that are already zeroed.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} kzero;
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&kzero.lock, "kzero");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcpu[i].lock, "kcpu");
   freerange(end, (void*)PHYSTOP);
 }
 
+static void
+buddy_push(struct run *r, int order)
+{
+  kmem.order[PGINDEX(r)] = PG_FREE | order;
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+}
+
+static void
+buddy_remove(struct run *r, int order)
+{
+  kmem.order[PGINDEX(r)] = 0;
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+}
+
+// Return a block of 2^order pages to the buddy allocator,
+// merging it with its buddy for as long as the buddy is free.
+// Caller must hold kmem.lock.
+static void
+buddy_free(void *pa, int order)
+{
+  uint64 i = PGINDEX(pa);
+
+  while(order < MAXORDER){
+    uint64 b = i ^ (1L << order);
+    if(b >= NPAGES || kmem.order[b] != (PG_FREE | order))
+      break;
+    buddy_remove((struct run*)(KERNBASE + b*PGSIZE), order);
+    i &= ~(1L << order);
+    order++;
+  }
+  buddy_push((struct run*)(KERNBASE + i*PGSIZE), order);
+}
+
+// Take a block of 2^order pages from the buddy allocator,
+// splitting a larger block if there is no free block of
+// exactly that order. Caller must hold kmem.lock.
+static void *
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  buddy_remove(r, k);
+  // give back the upper halves we do not need.
+  while(k > order){
+    k--;
+    buddy_push((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  return (void*)r;
+}
+
+// Hand [pa_start, pa_end) to the buddy allocator as the largest
+// naturally aligned blocks that fit.
 void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  uint64 i = PGINDEX(PGROUNDUP((uint64)pa_start));
+  uint64 last = PGINDEX(PGROUNDDOWN((uint64)pa_end));
+  int order;
+
+  acquire(&kmem.lock);
+  while(i < last){
+    for(order = MAXORDER; order > 0; order--)
+      if((i & ((1L << order) - 1)) == 0 && i + (1L << order) <= last)
+        break;
+    buddy_free((void*)(KERNBASE + i*PGSIZE), order);
+    i += 1L << order;
+    nfreepg += 1 << order;
+    ntotalpg += 1 << order;
+  }
+  release(&kmem.lock);
+}
+
+// Count n pages of type on this CPU.
+static void
+pgcount(int type, int n)
+{
+  push_off();
+  kcpu[cpuid()].used[type] += n;
+  pop_off();
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -46,37 +212,364 @@ freerange(void *pa_start, void *pa_end)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *head, *tail;
+  int id;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  int n = __atomic_sub_fetch(&pgref[PGINDEX(pa)], 1, __ATOMIC_ACQ_REL);
+  if(n > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+  __atomic_add_fetch(&nfreepg, 1, __ATOMIC_RELAXED);
+  pgcount(pgtype[PGINDEX(pa)], -1);
+
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
+  head = 0;
+
+  push_off();
+  id = cpuid();
+  acquire(&kcpu[id].lock);
+  r->next = kcpu[id].freelist;
+  kcpu[id].freelist = r;
+  if(++kcpu[id].nfree > PCP_HIGH){
+    // detach a batch to give back to the pool.
+    head = tail = kcpu[id].freelist;
+    for(int i = 1; i < PCP_BATCH; i++)
+      tail = tail->next;
+    kcpu[id].freelist = tail->next;
+    tail->next = 0;
+    kcpu[id].nfree -= PCP_BATCH;
+  }
+  release(&kcpu[id].lock);
+
+  if(head){
+    acquire(&kmem.lock);
+    while(head){
+      r = head;
+      head = r->next;
+      buddy_free(r, 0);
+    }
+    release(&kmem.lock);
+  }
+  pop_off();
+}
+
+// Move up to PCP_BATCH pages from the buddy allocator to CPU id's
+// list, or, if it is empty, half of some other CPU's list.
+// Caller must have interrupts off and must not hold kcpu[id].lock.
+static void
+refill(int id)
+{
+  struct run *r, *head = 0, *tail = 0;
+  int n = 0;
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  while(n < PCP_BATCH && (r = buddy_alloc(0)) != 0){
+    r->next = head;
+    if(head == 0)
+      tail = r;
+    head = r;
+    n++;
+  }
   release(&kmem.lock);
+
+  for(int i = 0; n == 0 && i < NCPU; i++){
+    if(i == id)
+      continue;
+    acquire(&kcpu[i].lock);
+    int want = (kcpu[i].nfree + 1) / 2;
+    while(n < want && (r = kcpu[i].freelist) != 0){
+      kcpu[i].freelist = r->next;
+      r->next = head;
+      if(head == 0)
+        tail = r;
+      head = r;
+      n++;
+    }
+    kcpu[i].nfree -= n;
+    release(&kcpu[i].lock);
+  }
+
+  if(n == 0)
+    return;
+  acquire(&kcpu[id].lock);
+  tail->next = kcpu[id].freelist;
+  kcpu[id].freelist = head;
+  kcpu[id].nfree += n;
+  release(&kcpu[id].lock);
+}
+
+// Take a page from the pre-zeroed pool, or return 0.
+static void *
+zpop(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.nfree--;
+  }
+  release(&kzero.lock);
+  return (void*)r;
+}
+
+// Take a page from this CPU's free list, refilling it if it
+// is empty, or return 0.
+static void *
+pcpalloc(void)
+{
+  struct run *r;
+  int id;
+
+  push_off();
+  id = cpuid();
+  acquire(&kcpu[id].lock);
+  if(kcpu[id].freelist == 0){
+    release(&kcpu[id].lock);
+    refill(id);
+    acquire(&kcpu[id].lock);
+  }
+  r = kcpu[id].freelist;
+  if(r){
+    kcpu[id].freelist = r->next;
+    kcpu[id].nfree--;
+  }
+  release(&kcpu[id].lock);
+  pop_off();
+  return (void*)r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// The contents of the page are undefined.
 void *
 kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  r = pcpalloc();
+  // then a page kzerod has already zeroed.
+  if(r == 0)
+    r = zpop();
+  // last resort: pages the caches can give back.
+  if(r == 0 && kreclaim() > 0)
+    r = pcpalloc();
+  if(r){
+    pgref[PGINDEX(r)] = 1;
+    pgtype[PGINDEX(r)] = MEM_OTHER;
+    __atomic_sub_fetch(&nfreepg, 1, __ATOMIC_RELAXED);
+    pgcount(MEM_OTHER, 1);
+  }
 
+#ifdef KALLOC_DEBUG
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
+
+// Add a reference to an allocated page.
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+  __atomic_add_fetch(&pgref[PGINDEX(pa)], 1, __ATOMIC_ACQ_REL);
+}
+
+// Number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(&pgref[PGINDEX(pa)], __ATOMIC_ACQUIRE);
+}
+
+// Say what the allocated page pa is used for: one of the
+// MEM_* types in memstat.h.
+void
+kpgtype(void *pa, int type)
+{
+  uint64 i = PGINDEX(pa);
+
+  if(type < 0 || type >= NMEMTYPE)
+    panic("kpgtype");
+  push_off();
+  kcpu[cpuid()].used[pgtype[i]]--;
+  kcpu[cpuid()].used[type]++;
+  pop_off();
+  pgtype[i] = type;
+}
+
+// Number of free pages.
+int
+kfreepages(void)
+{
+  return __atomic_load_n(&nfreepg, __ATOMIC_RELAXED);
+}
+
+// Fill in the allocator's part of *ms, summing the CPUs' counts.
+void
+kmemstat(struct memstat *ms)
+{
+  ms->total = ntotalpg;
+  ms->free = kfreepages();
+  ms->zeroed = kzero.nfree;
+  for(int t = 0; t < NMEMTYPE; t++){
+    int n = 0;
+    for(int i = 0; i < NCPU; i++)
+      n += kcpu[i].used[t];
+    ms->used[t] = n < 0 ? 0 : n;
+  }
+}
+
+// Give back the memory that caches are holding on to: file
+// pages that no process maps, slabs with no objects in use, and
+// the shells of dead processes.
+// Returns the number of pages freed.
+int
+kreclaim(void)
+{
+  return pcacheshrink() + kmalloc_drain() + procshrink();
+}
+
+// Give every page on the per-CPU lists back to the buddy
+// allocator, so that they can coalesce into larger blocks.
+static void
+kdrain(void)
+{
+  struct run *r, *head;
+
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kcpu[i].lock);
+    head = kcpu[i].freelist;
+    kcpu[i].freelist = 0;
+    kcpu[i].nfree = 0;
+    release(&kcpu[i].lock);
+
+    acquire(&kmem.lock);
+    while(head){
+      r = head;
+      head = r->next;
+      buddy_free(r, 0);
+    }
+    release(&kmem.lock);
+  }
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns 0 if no such block is free.
+void *
+kalloc_pages(int order)
+{
+  void *pa;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  acquire(&kmem.lock);
+  pa = buddy_alloc(order);
+  release(&kmem.lock);
+
+  if(pa == 0){
+    // cached single pages may be all that keeps a block apart.
+    kdrain();
+    acquire(&kmem.lock);
+    pa = buddy_alloc(order);
+    release(&kmem.lock);
+  }
+  if(pa){
+    for(int i = 0; i < (1 << order); i++){
+      pgref[PGINDEX(pa) + i] = 1;
+      pgtype[PGINDEX(pa) + i] = MEM_OTHER;
+    }
+    __atomic_sub_fetch(&nfreepg, 1 << order, __ATOMIC_RELAXED);
+    pgcount(MEM_OTHER, 1 << order);
+  }
+
+#ifdef KALLOC_DEBUG
+  if(pa)
+    memset(pa, 5, PGSIZE << order); // fill with junk
+#endif
+  return pa;
+}
+
+// Free 2^order pages returned by kalloc_pages(order).
+void
+kfree_pages(void *pa, int order)
+{
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(((uint64)pa % (PGSIZE << order)) != 0 || (char*)pa < end ||
+     (uint64)pa + (PGSIZE << order) > PHYSTOP || order > MAXORDER)
+    panic("kfree_pages");
+
+#ifdef KALLOC_DEBUG
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  for(int i = 0; i < (1 << order); i++)
+    pgcount(pgtype[PGINDEX(pa) + i], -1);
+  acquire(&kmem.lock);
+  buddy_free(pa, order);
+  release(&kmem.lock);
+  __atomic_add_fetch(&nfreepg, 1 << order, __ATOMIC_RELAXED);
+}
+
+// Allocate one zeroed 4096-byte page of physical memory,
+// from the pre-zeroed pool if it has any.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  void *pa;
+
+  if((pa = zpop()) != 0){
+    pgref[PGINDEX(pa)] = 1;
+    pgtype[PGINDEX(pa)] = MEM_OTHER;
+    __atomic_sub_fetch(&nfreepg, 1, __ATOMIC_RELAXED);
+    pgcount(MEM_OTHER, 1);
+    return pa;
+  }
+  if((pa = kalloc()) != 0)
+    memset(pa, 0, PGSIZE);
+  return pa;
+}
+
+// Body of the kzerod kernel thread: keep the pre-zeroed pool
+// topped up to ZPOOL_HIGH pages, zeroing pages while the CPU
+// would otherwise be idle, and check again every clock tick.
+// Allocating processes never wait for kzerod.
+void
+kzerod(void)
+{
+  struct run *r;
+
+  for(;;){
+    while(kzero.nfree < ZPOOL_HIGH && (r = pcpalloc()) != 0){
+      memset(r, 0, PGSIZE);
+      acquire(&kzero.lock);
+      r->next = kzero.freelist;
+      kzero.freelist = r;
+      kzero.nfree++;
+      release(&kzero.lock);
+    }
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+  }
+}
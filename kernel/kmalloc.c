@@ -0,0 +1,238 @@
+// Slab allocator for small kernel objects.
+//
+// kmalloc(n) rounds n up to one of the power-of-two size classes
+// from KMALLOC_MIN to KMALLOC_MAX bytes. Each size class has a
+// cache of slabs; a slab is one page from kalloc() that ends
+// with a struct slab header and is carved into objects of that
+// size. kmfree() finds the slab, and so the cache, by rounding
+// the object's address down to a page boundary. A slab whose
+// objects are all free goes back to kalloc().
+//
+// In front of each cache, every CPU keeps a small magazine of
+// recently freed objects, so that most kmalloc() and kmfree()
+// calls only touch a per-CPU lock.
+//
+// Objects bigger than KMALLOC_MAX should use kalloc().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define KMALLOC_MIN  32
+#define KMALLOC_MAX  1024
+#define NKCACHE      6    // size classes 32, 64, ..., 1024
+#define MAGSIZE      8    // objects in a per-CPU magazine
+
+struct kobj {
+  struct kobj *next;
+};
+
+struct kcache;
+
+// sits at the end of each slab page.
+#define SLAB(obj) ((struct slab*)(PGROUNDDOWN((uint64)(obj)) + PGSIZE - sizeof(struct slab)))
+
+struct slab {
+  struct kcache *cache;
+  struct slab *next;      // on the cache's list of partial slabs
+  struct slab *prev;
+  struct kobj *free;      // free objects in this slab
+  int inuse;              // objects handed out
+  int partial;            // on the partial list?
+};
+
+struct magazine {
+  struct spinlock lock;
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kcache {
+  struct spinlock lock;
+  uint size;              // object size
+  struct slab *partial;   // slabs with at least one free object
+  struct magazine mag[NCPU];
+} kcache[NKCACHE];
+
+void
+kmallocinit(void)
+{
+  for(int i = 0; i < NKCACHE; i++){
+    struct kcache *c = &kcache[i];
+    initlock(&c->lock, "kcache");
+    c->size = KMALLOC_MIN << i;
+    c->partial = 0;
+    for(int j = 0; j < NCPU; j++){
+      initlock(&c->mag[j].lock, "kmag");
+      c->mag[j].n = 0;
+    }
+  }
+}
+
+static void
+partial_push(struct kcache *c, struct slab *s)
+{
+  s->partial = 1;
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+static void
+partial_remove(struct kcache *c, struct slab *s)
+{
+  s->partial = 0;
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Take an object from one of c's slabs, allocating a new
+// slab if none has a free object.
+static void *
+slab_alloc(struct kcache *c)
+{
+  struct slab *s;
+  struct kobj *o;
+
+  acquire(&c->lock);
+  if((s = c->partial) == 0){
+    release(&c->lock);
+    char *p = kalloc();
+    if(p == 0)
+      return 0;
+    kpgtype(p, MEM_SLAB);
+    s = SLAB(p);
+    s->cache = c;
+    s->free = 0;
+    s->inuse = 0;
+    for(; p + c->size <= (char*)s; p += c->size){
+      o = (struct kobj*)p;
+      o->next = s->free;
+      s->free = o;
+    }
+    acquire(&c->lock);
+    partial_push(c, s);
+  }
+  o = s->free;
+  s->free = o->next;
+  s->inuse++;
+  if(s->free == 0)
+    partial_remove(c, s);
+  release(&c->lock);
+  return (void*)o;
+}
+
+// Return an object to its slab, and the slab to kalloc()
+// if that was its last object in use. Returns 1 if the slab
+// went back, 0 if not.
+static int
+slab_free(struct kcache *c, void *obj)
+{
+  struct slab *s = SLAB(obj);
+  struct kobj *o = (struct kobj*)obj;
+
+  acquire(&c->lock);
+  o->next = s->free;
+  s->free = o;
+  s->inuse--;
+  if(s->inuse == 0){
+    if(s->partial)
+      partial_remove(c, s);
+    release(&c->lock);
+    kfree((void*)PGROUNDDOWN((uint64)s));
+    return 1;
+  }
+  if(!s->partial)
+    partial_push(c, s);
+  release(&c->lock);
+  return 0;
+}
+
+// Allocate n bytes, 0 < n <= KMALLOC_MAX, aligned to the
+// size class they round up to. Returns 0 if out of memory.
+// The contents are undefined.
+void *
+kmalloc(uint n)
+{
+  struct kcache *c;
+  struct magazine *m;
+  void *obj = 0;
+  int i;
+
+  if(n == 0 || n > KMALLOC_MAX)
+    panic("kmalloc");
+  for(i = 0; (KMALLOC_MIN << i) < n; i++)
+    ;
+  c = &kcache[i];
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  release(&m->lock);
+  pop_off();
+
+  if(obj == 0)
+    obj = slab_alloc(c);
+  return obj;
+}
+
+// Free an object returned by kmalloc().
+void
+kmfree(void *obj)
+{
+  struct kcache *c = SLAB(obj)->cache;
+  struct magazine *m;
+
+  if(c < kcache || c >= kcache + NKCACHE)
+    panic("kmfree");
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n < MAGSIZE){
+    m->obj[m->n++] = obj;
+    obj = 0;
+  }
+  release(&m->lock);
+  pop_off();
+
+  if(obj)
+    slab_free(c, obj);
+}
+
+// Empty every CPU's magazines back into the slabs, so that
+// slabs with no objects in use return to kalloc().
+// Returns the number of pages given back.
+int
+kmalloc_drain(void)
+{
+  void *obj[MAGSIZE];
+  int n, freed = 0;
+
+  for(int i = 0; i < NKCACHE; i++){
+    struct kcache *c = &kcache[i];
+    for(int j = 0; j < NCPU; j++){
+      struct magazine *m = &c->mag[j];
+      acquire(&m->lock);
+      n = m->n;
+      memmove(obj, m->obj, n * sizeof(void*));
+      m->n = 0;
+      release(&m->lock);
+      while(n > 0)
+        freed += slab_free(c, obj[--n]);
+    }
+  }
+  return freed;
+}
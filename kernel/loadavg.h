@@ -0,0 +1,30 @@
+// System load statistics, returned by the getload() system call.
+// Both the kernel and user programs use this header file.
+
+// load averages are fixed-point numbers with FSHIFT bits of fraction.
+#define FSHIFT    11
+#define FIXED_1   (1<<FSHIFT)
+
+// sample the run queue every LOAD_FREQ clock ticks (~5 seconds in qemu).
+#define LOAD_FREQ 50
+
+// exp(-5sec/1min), exp(-5sec/5min), exp(-5sec/15min) in fixed point.
+#define EXP_1     1884
+#define EXP_5     2014
+#define EXP_15    2037
+
+// time-CSR cycles each CPU has spent since boot.
+struct cpuload {
+  uint64 busy;       // running processes
+  uint64 idle;       // in the scheduler with nothing to run
+};
+
+struct loadavg {
+  uint64 avg[3];     // 1, 5 and 15 minute load averages (fixed point)
+  int nrunning;      // processes RUNNING right now
+  int nrunnable;     // processes RUNNABLE right now
+  int nproc;         // processes in use
+  int ncpu;          // entries of cpu[] that are valid
+  uint ticks;        // clock ticks since boot
+  struct cpuload cpu[NCPU];
+};
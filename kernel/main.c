@@ -17,6 +17,7 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    kmallocinit();   // slab caches for small objects
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -27,8 +28,13 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pcacheinit();    // shared file pages
+    shminit();       // shared-memory segments
+    swapinit();      // swap slots
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
+    kthread("kzerod", kzerod); // pre-zeroed page pool
+    kthread("kswapd", kswapd); // keeps WMARK_LOW pages free
     __sync_synchronize();
     started = 1;
   } else {
@@ -51,6 +51,12 @@
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
 
+// the upper half of the Sv39 address space, above the
+// addresses that MAXVA allows, is a window onto the current
+// process's user memory when the kernel is made with SUMCOPY=1:
+// user address va appears at UWINDOW + va.
+#define UWINDOW 0xffffffc000000000L
+
 // map kernel stacks beneath the trampoline,
 // each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
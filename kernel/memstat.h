@@ -0,0 +1,23 @@
+// Physical memory statistics, returned by the memstat() system call.
+// Both the kernel and user programs use this header file.
+
+// what an allocated page is used for; see kpgtype() in kalloc.c.
+#define MEM_OTHER      0   // everything not counted below
+#define MEM_USER       1   // user memory, including cached file pages
+#define MEM_PAGETABLE  2   // page-table pages
+#define MEM_KSTACK     3   // kernel stacks
+#define MEM_SLAB       4   // kmalloc() slabs, which hold pipes among others
+#define NMEMTYPE       5
+
+// counts are in pages, except where noted.
+struct memstat {
+  uint64 total;             // pages the allocator manages
+  uint64 free;              // free pages, including the zeroed pool
+  uint64 zeroed;            // free pages kzerod has zeroed already
+  uint64 used[NMEMTYPE];    // allocated pages, by MEM_* type
+  uint64 pcache;            // user pages held by the page cache
+  uint64 swaptotal;         // swap slots
+  uint64 swapused;          // swap slots holding a page
+  uint64 nbuf;              // buffers in the buffer cache, BSIZE each
+  uint64 npipe;             // open pipes
+};
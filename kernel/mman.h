@@ -0,0 +1,13 @@
+#define PROT_NONE     0x0
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define PROT_EXEC     0x4
+
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+
+#define MAP_FAILED    ((void *) -1)
+
+#define MADV_NORMAL   0
+#define MADV_DONTNEED 4
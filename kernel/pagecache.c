@@ -0,0 +1,221 @@
+//
+// Page cache: whole pages of file contents, shared by every
+// process that maps them.
+//
+// vmafault() maps a cached page read-only into each process that
+// executes the same binary, instead of reading a private copy, and
+// copy-on-write for a writable segment; MAP_SHARED mappings map it
+// writable. A cached page is identified by device, inode number and
+// page-aligned file offset, and the cache holds one reference to it
+// (see kref() in kalloc.c). Bytes of a cached page past the end of
+// the file are zero.
+//
+// Program segments and mmap() regions never share a cached page:
+// each offset may have a text page and an mmap() page. writei()
+// copies what it writes into the mmap() page, so mappings see
+// write()s, and drops the text page, so that rewriting a binary,
+// or storing to a MAP_SHARED mapping of it, doesn't change the
+// code of programs running it: they keep the old page, and later
+// faults read the new contents. Truncating a file
+// drops its cached pages; processes that already map them keep the
+// old contents. Pages only the cache refers to are given back by
+// pcacheshrink() when memory runs out.
+//
+// pcacheget() and pcacheadd() must be called with the inode locked,
+// which keeps writei() from invalidating between a read and an add.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCHASH 61
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;              // file offset, page-aligned
+  int text;              // for program segments, not mmap()
+  void *pa;
+  struct pcpage *next;   // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage *hash[NPCHASH];
+  int npages;
+} pcache;
+
+static struct pcpage**
+bucket(uint dev, uint inum, uint off)
+{
+  return &pcache.hash[(dev * 31 + inum * 17 + off / PGSIZE) % NPCHASH];
+}
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the cached page holding ip's contents at off, with a
+// reference for the caller, or 0 if it is not cached. text says
+// whether the caller wants the page for a program segment or the
+// one for mmap().
+void*
+pcacheget(struct inode *ip, uint off, int text)
+{
+  struct pcpage *pp;
+  void *pa = 0;
+
+  acquire(&pcache.lock);
+  for(pp = *bucket(ip->dev, ip->inum, off); pp; pp = pp->next){
+    if(pp->dev == ip->dev && pp->inum == ip->inum && pp->off == off &&
+       pp->text == text){
+      pa = pp->pa;
+      kref(pa);
+      break;
+    }
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Offer pa, a page the caller has filled with ip's contents at off
+// and holds a reference to, to the cache. The caller keeps its
+// reference whether or not the cache takes the page. text is as
+// for pcacheget().
+void
+pcacheadd(struct inode *ip, uint off, void *pa, int text)
+{
+  struct pcpage *pp, **b;
+
+  // allocate before taking the lock, since kalloc() may
+  // call pcacheshrink().
+  if((pp = kmalloc(sizeof(*pp))) == 0)
+    return;
+  pp->dev = ip->dev;
+  pp->inum = ip->inum;
+  pp->off = off;
+  pp->text = text;
+  pp->pa = pa;
+
+  acquire(&pcache.lock);
+  b = bucket(ip->dev, ip->inum, off);
+  pp->next = *b;
+  *b = pp;
+  pcache.npages++;
+  kref(pa);
+  release(&pcache.lock);
+}
+
+// Copy n bytes written to ip at off into the cached mmap() page
+// holding them, if there is one, and drop the text page. The
+// bytes must lie within one page.
+void
+pcacheupdate(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcpage *pp, **ppp, *dead = 0;
+  uint pgoff = PGROUNDDOWN(off);
+
+  acquire(&pcache.lock);
+  if(pcache.npages > 0){
+    for(ppp = bucket(ip->dev, ip->inum, pgoff); (pp = *ppp) != 0; ){
+      if(pp->dev == ip->dev && pp->inum == ip->inum && pp->off == pgoff){
+        if(pp->text){
+          *ppp = pp->next;
+          pp->next = dead;
+          dead = pp;
+          pcache.npages--;
+          continue;
+        }
+        memmove((char*)pp->pa + (off - pgoff), src, n);
+      }
+      ppp = &pp->next;
+    }
+  }
+  release(&pcache.lock);
+
+  while((pp = dead) != 0){
+    dead = pp->next;
+    kfree(pp->pa);
+    kmfree(pp);
+  }
+}
+
+// Drop ip's cached pages that overlap [off, off+n).
+void
+pcacheinval(struct inode *ip, uint off, uint n)
+{
+  struct pcpage *pp, **ppp, *dead = 0;
+
+  acquire(&pcache.lock);
+  if(pcache.npages == 0){
+    release(&pcache.lock);
+    return;
+  }
+  for(int i = 0; i < NPCHASH; i++){
+    for(ppp = &pcache.hash[i]; (pp = *ppp) != 0; ){
+      if(pp->dev == ip->dev && pp->inum == ip->inum &&
+         pp->off + PGSIZE > off && pp->off < off + n){
+        *ppp = pp->next;
+        pp->next = dead;
+        dead = pp;
+        pcache.npages--;
+      } else {
+        ppp = &pp->next;
+      }
+    }
+  }
+  release(&pcache.lock);
+
+  while((pp = dead) != 0){
+    dead = pp->next;
+    kfree(pp->pa);
+    kmfree(pp);
+  }
+}
+
+// Number of pages in the cache.
+int
+pcachepages(void)
+{
+  return pcache.npages;
+}
+
+// Give back every cached page that no process maps.
+// Returns the number of pages freed.
+int
+pcacheshrink(void)
+{
+  struct pcpage *pp, **ppp, *dead = 0;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(int i = 0; i < NPCHASH; i++){
+    for(ppp = &pcache.hash[i]; (pp = *ppp) != 0; ){
+      if(krefcnt(pp->pa) == 1){
+        *ppp = pp->next;
+        pp->next = dead;
+        dead = pp;
+        pcache.npages--;
+        n++;
+      } else {
+        ppp = &pp->next;
+      }
+    }
+  }
+  release(&pcache.lock);
+
+  while((pp = dead) != 0){
+    dead = pp->next;
+    kfree(pp->pa);
+    kmfree(pp);
+  }
+  return n;
+}
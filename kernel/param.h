@@ -1,6 +1,8 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NVMA         16  // mapped regions per process
+#define NSHM         16  // shared-memory segments per system
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
@@ -10,4 +12,11 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
+#define NSWAP        8192  // page-sized swap slots on disk, after the file system
+#define SWAPSTART    FSSIZE  // first disk block of the swap area
+#define SWAPBLOCKS   (NSWAP * 4)  // disk blocks in the swap area
+#define WMARK_MIN    64    // free pages that user memory may not use
+#define WMARK_LOW    256   // kswapd reclaims when fewer pages are free
+#define WMARK_HIGH   512   // and stops when this many are
+#define OOMWAIT      100   // ticks a fault waits for OOM-killed processes
 #define MAXPATH      128   // maximum file path name
@@ -3,6 +3,7 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
@@ -19,6 +20,8 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+int npipe;        // pipes in use
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +31,14 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kmalloc(sizeof(struct pipe))) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
   initlock(&pi->lock, "pipe");
+  __atomic_add_fetch(&npipe, 1, __ATOMIC_RELAXED);
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -47,7 +51,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmfree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -55,6 +59,13 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+// Number of pipes in use.
+int
+pipecount(void)
+{
+  return __atomic_load_n(&npipe, __ATOMIC_RELAXED);
+}
+
 void
 pipeclose(struct pipe *pi, int writable)
 {
@@ -68,36 +79,48 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kmfree(pi);
+    __atomic_sub_fetch(&npipe, 1, __ATOMIC_RELAXED);
   } else
     release(&pi->lock);
 }
 
+// pipewrite() and piperead() move data between user space and
+// the pipe through a buffer on the kernel stack, so that they do
+// not hold pi->lock while copyin() or copyout() page-fault.
+#define PIPECHUNK 128
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, j, m;
+  char buf[PIPECHUNK];
   struct proc *pr = myproc();
 
-  acquire(&pi->lock);
   while(i < n){
-    if(pi->readopen == 0 || killed(pr)){
-      release(&pi->lock);
-      return -1;
-    }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    m = n - i;
+    if(m > PIPECHUNK)
+      m = PIPECHUNK;
+    if(copyin(pr->pagetable, buf, addr + i, m) == -1)
+      break;
+
+    acquire(&pi->lock);
+    for(j = 0; j < m; ){
+      if(pi->readopen == 0 || killed(pr)){
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+      } else {
+        pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
+      }
     }
+    wakeup(&pi->nread);
+    release(&pi->lock);
+    i += m;
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
@@ -105,9 +128,9 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m;
+  char buf[PIPECHUNK];
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -117,14 +140,18 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
+    for(m = 0; i + m < n && m < PIPECHUNK; m++){
+      if(pi->nread == pi->nwrite)
+        break;
+      buf[m] = pi->data[pi->nread++ % PIPESIZE];
+    }
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+    release(&pi->lock);
+    if(m == 0 || copyout(pr->pagetable, addr + i, buf, m) == -1)
+      return i;
+    acquire(&pi->lock);
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
@@ -3,8 +3,11 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
+#include "loadavg.h"
+#include "memstat.h"
 #include <limits.h>
 
 
@@ -14,6 +17,23 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// A process shell: a trapframe page, and a user page table that
+// maps nothing but it and the trampoline. freeproc() strips a
+// dead process down to its shell and keeps it here, in a small
+// cache on each CPU, for allocproc() to hand to the next one.
+#define NSHELL 4
+
+struct shell {
+  struct trapframe *trapframe;
+  pagetable_t pagetable;
+};
+
+struct {
+  struct spinlock lock;
+  int n;
+  struct shell shell[NSHELL];
+} shells[NCPU];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
@@ -38,6 +58,10 @@ int cfs_proc_timeslice_len = 0;
 // number of timeslices that the above process can still run
 int cfs_proc_timeslice_left = 0;
 
+// exponentially decayed 1, 5 and 15 minute run-queue lengths,
+// in FSHIFT fixed point. updated by calc_load().
+uint64 avenrun[3];
+
 // Nice to weight conversion table
 int nice_to_weight[40] = {
     88761, 71755, 56483, 46273, 36291, /*for nice = -20, ..., -16*/
@@ -51,7 +75,9 @@ int nice_to_weight[40] = {
 };
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
+static int shellget(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -78,7 +104,7 @@ int weight_sum()
     if (current_proc && current_proc->state == RUNNABLE)
     {
       // +20 since array is range 0-39, but nice values are range -20-19
-      sum += nice_to_weight[current_proc->nice + 20];
+      sum += nice_to_weight[current_proc->effnice + 20];
     }
   }
 
@@ -125,11 +151,15 @@ int sys_nice(int new_nice){
 
   argint(0, &new_nice);
 
+  acquire(&p->lock);
   if(new_nice >= -20 && new_nice <= 19){
     p->nice = new_nice;
+    inheritprio(p);
   }
+  new_nice = p->nice;
+  release(&p->lock);
 
-  return p->nice;
+  return new_nice;
 }
 
 // Starts the cfs by setting cfs to 1
@@ -146,6 +176,26 @@ int sys_stopcfs(){
   return 1;
 }
 
+// Switch from the scheduler on CPU c to process p, which must be
+// locked and RUNNING, and charge the time until it gives the CPU
+// back to c's busy counter.
+static void
+sched_run(struct cpu *c, struct proc *p)
+{
+  uint64 start = r_time();
+
+  // p's kernel stack may be newly mapped.
+  kvmstackfence();
+
+  // p's clock starts now; sched() stops it.
+  p->tstamp = start;
+  swtch(&c->context, &p->context);
+  c->busy += r_time() - start;
+
+  // p may run on another cpu next.
+  uwinclose();
+}
+
 // Implementation of our CFS Scheduler
 void cfs_scheduler(struct cpu *c)
 {
@@ -164,7 +214,7 @@ void cfs_scheduler(struct cpu *c)
   {
     // when the current process uses up its timeslices or becomes not runnable
     // it should not be picked to run next and its vruntime should be updated
-    int weight = nice_to_weight[cfs_current_proc->nice + 20]; // convert nice to weight
+    int weight = nice_to_weight[cfs_current_proc->effnice + 20]; // convert nice to weight
     int inc = (cfs_proc_timeslice_len - cfs_proc_timeslice_left) * 1024 / weight;
     // compute the increment of its vruntime according to CFS design
     if (inc < 1)
@@ -197,7 +247,7 @@ void cfs_scheduler(struct cpu *c)
 
       // Helper variables for readability
       int weightSum = weight_sum();
-      int schedLatencyTimesWeight = cfs_sched_latency * nice_to_weight[cfs_current_proc->nice + 20];
+      int schedLatencyTimesWeight = cfs_sched_latency * nice_to_weight[cfs_current_proc->effnice + 20];
 
       // calculate timeslice len using the equation above
       cfs_proc_timeslice_len = schedLatencyTimesWeight / weightSum;
@@ -234,7 +284,7 @@ void cfs_scheduler(struct cpu *c)
       // schedule c->process to run
       acquire(&c->proc->lock);
       c->proc->state = RUNNING;
-      swtch(&c->context, &c->proc->context);
+      sched_run(c, c->proc);
       release(&c->proc->lock);
     }
   }
@@ -247,13 +297,12 @@ void proc_mapstacks(pagetable_t kpgtbl)
 {
   struct proc *p;
 
+  // only the page-table pages; allocproc() maps each stack
+  // with kvmstack() the first time its slot is used.
   for (p = proc; p < &proc[NPROC]; p++)
   {
-    char *pa = kalloc();
-    if (pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int)(p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+    if (walk(kpgtbl, KSTACK((int)(p - proc)), 1) == 0)
+      panic("proc_mapstacks");
   }
 }
 
@@ -264,6 +313,8 @@ void procinit(void)
 
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for (int i = 0; i < NCPU; i++)
+    initlock(&shells[i].lock, "shells");
   for (p = proc; p < &proc[NPROC]; p++)
   {
     initlock(&p->lock, "proc");
@@ -341,17 +392,17 @@ found:
   p->pid = allocpid();
   p->state = USED;
 
-  // Allocate a trapframe page.
-  if ((p->trapframe = (struct trapframe *)kalloc()) == 0)
+  // A kernel stack, the first time this slot is used.
+  if (kvmstack(p->kstack) < 0)
   {
     freeproc(p);
     release(&p->lock);
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if (p->pagetable == 0)
+  // A trapframe page and an empty user page table,
+  // from this CPU's cache if it has them.
+  if (shellget(p) < 0)
   {
     freeproc(p);
     release(&p->lock);
@@ -367,18 +418,109 @@ found:
   return p;
 }
 
+// Give p a trapframe and an empty user page table, taken from
+// this CPU's cache of shells or else newly made.
+// Returns 0 on success, -1 if out of memory.
+static int
+shellget(struct proc *p)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  acquire(&shells[id].lock);
+  if (shells[id].n > 0)
+  {
+    struct shell *s = &shells[id].shell[--shells[id].n];
+    p->trapframe = s->trapframe;
+    p->pagetable = s->pagetable;
+  }
+  release(&shells[id].lock);
+  pop_off();
+  if (p->pagetable)
+    return 0;
+
+  if ((p->trapframe = (struct trapframe *)kalloc()) == 0)
+    return -1;
+  if ((p->pagetable = proc_pagetable(p)) == 0)
+    return -1;
+  return 0;
+}
+
+// Free p's user memory, and keep its trapframe and stripped
+// page table in this CPU's cache of shells if there is room.
+static void
+shellput(struct proc *p)
+{
+  int id;
+
+  uvmstrip(p->pagetable, p->sz);
+  push_off();
+  id = cpuid();
+  acquire(&shells[id].lock);
+  if (shells[id].n < NSHELL)
+  {
+    struct shell *s = &shells[id].shell[shells[id].n++];
+    s->trapframe = p->trapframe;
+    s->pagetable = p->pagetable;
+    p->trapframe = 0;
+    p->pagetable = 0;
+  }
+  release(&shells[id].lock);
+  pop_off();
+  if (p->pagetable)
+  {
+    proc_freepagetable(p->pagetable, 0);
+    kfree((void *)p->trapframe);
+    p->trapframe = 0;
+    p->pagetable = 0;
+  }
+}
+
+// Free the shells cached on every CPU, for kreclaim().
+// Returns the number of pages freed.
+int
+procshrink(void)
+{
+  struct shell s;
+  int n = 0;
+
+  for (int i = 0; i < NCPU; i++)
+  {
+    for (;;)
+    {
+      acquire(&shells[i].lock);
+      if (shells[i].n == 0)
+      {
+        release(&shells[i].lock);
+        break;
+      }
+      s = shells[i].shell[--shells[i].n];
+      release(&shells[i].lock);
+      n += 4; // the trapframe and three page-table pages
+      proc_freepagetable(s.pagetable, 0);
+      kfree((void *)s.trapframe);
+    }
+  }
+  return n;
+}
+
 // free a proc structure and the data hanging from it,
 // including user pages.
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
 {
+  if (p->pagetable && p->trapframe)
+    shellput(p);
   if (p->trapframe)
     kfree((void *)p->trapframe);
   p->trapframe = 0;
   if (p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  p->asidgen = 0;
+  memset(p->wcache, 0, sizeof(p->wcache));
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -389,7 +531,13 @@ freeproc(struct proc *p)
   p->state = UNUSED;
   p->swapcount = 0;
   p->nice = 0;  // Set nice to 0
+  p->effnice = 0;
+  p->held = 0;
+  p->kfn = 0;
+  p->swaphand = 0;
   p->vruntime = 0; // Set vrtuntime to 0
+  memset(&p->ru, 0, sizeof(p->ru));
+  memset(&p->cru, 0, sizeof(p->cru));
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -474,6 +622,25 @@ void userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel thread: a process with no user memory that
+// runs fn() in the kernel at the lowest priority. fn must
+// never return.
+void kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    panic("kthread");
+
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  p->nice = p->effnice = 19;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
@@ -484,14 +651,20 @@ int growproc(int n)
   sz = p->sz;
   if (n > 0)
   {
-    if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0)
+    // pages are allocated by vmfault() when first touched.
+    if (sz + n < sz || sz + n > vmabase(p))
     {
       return -1;
     }
+    sz += n;
   }
   else if (n < 0)
   {
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if ((sz = uvmdealloc(p->pagetable, sz, sz + n)) == p->sz)
+    {
+      return -1;
+    }
+    vmatrim(p, sz);
   }
   p->sz = sz;
   return 0;
@@ -512,13 +685,14 @@ int fork(void)
   }
 
   // Copy user memory from parent to child.
-  if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0)
+  np->sz = p->sz;
+  if (uvmcopy(p->pagetable, np->pagetable, 0, p->sz) < 0 ||
+      vmacopy(np, p) < 0)
   {
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -549,6 +723,55 @@ int fork(void)
   return pid;
 }
 
+// Start a new child process running the program at path with
+// arguments argv, without copying the current process's memory
+// as fork() and exec() would. The child's file descriptors 0, 1
+// and 2 are f[0..2], and it gets no others.
+// Returns the child's pid, or -1 if the program couldn't be run.
+int spawn(char *path, char **argv, struct file **f)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if ((np = allocproc()) == 0)
+    return -1;
+  // np stays USED, so nothing else touches it, while exec
+  // reads the program.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  np->cwd = idup(p->cwd);
+  if ((argc = execproc(np, path, argv)) < 0)
+  {
+    begin_op();
+    iput(np->cwd);
+    end_op();
+    np->cwd = 0;
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  for (i = 0; i < 3; i++)
+    if (f[i])
+      np->ofile[i] = filedup(f[i]);
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void reparent(struct proc *p)
@@ -586,6 +809,8 @@ void exit(int status)
     }
   }
 
+  vmaclear(p->pagetable, p->vma);
+
   begin_op();
   iput(p->cwd);
   end_op();
@@ -611,13 +836,37 @@ void exit(int status)
   panic("zombie exit");
 }
 
+// Add the counters in b to a.
+static void
+ruadd(struct rusage *a, struct rusage *b)
+{
+  a->utime += b->utime;
+  a->stime += b->stime;
+  a->nvcsw += b->nvcsw;
+  a->nivcsw += b->nivcsw;
+  a->inblock += b->inblock;
+  a->oublock += b->oublock;
+  a->minflt += b->minflt;
+  a->majflt += b->majflt;
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int wait(uint64 addr)
+{
+  return wait4(-1, addr, 0);
+}
+
+// Wait for the child with the given pid (or any child, if pid
+// is -1) to exit and return its pid. If raddr is not zero, copy
+// out the resources used by the child and its own children.
+// Return -1 if this process has no such children.
+int wait4(int pid, uint64 addr, uint64 raddr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, xstate;
   struct proc *p = myproc();
+  struct rusage ru;
 
   acquire(&wait_lock);
 
@@ -627,7 +876,7 @@ int wait(uint64 addr)
     havekids = 0;
     for (pp = proc; pp < &proc[NPROC]; pp++)
     {
-      if (pp->parent == p)
+      if (pp->parent == p && (pid == -1 || pp->pid == pid))
       {
         // make sure the child isn't still in exit() or swtch().
         acquire(&pp->lock);
@@ -637,13 +886,25 @@ int wait(uint64 addr)
         {
           // Found one.
           pid = pp->pid;
-          if (addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                   sizeof(pp->xstate)) < 0)
+          xstate = pp->xstate;
+          ru = pp->ru;
+          ruadd(&ru, &pp->cru);
+          release(&pp->lock);
+          release(&wait_lock);
+
+          // copy out without holding spinlocks, since the user
+          // pages may have to be faulted in from disk. only this
+          // process can reap pp, so it stays a zombie meanwhile.
+          if ((addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                    sizeof(xstate)) < 0) ||
+              (raddr != 0 && copyout(p->pagetable, raddr, (char *)&ru,
+                                     sizeof(ru)) < 0))
           {
-            release(&pp->lock);
-            release(&wait_lock);
             return -1;
           }
+          acquire(&wait_lock);
+          acquire(&pp->lock);
+          ruadd(&p->cru, &ru);
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
@@ -679,7 +940,7 @@ void old_scheduler(struct cpu *c)
       // before jumping back to us.
       p->state = RUNNING;
       c->proc = p;
-      swtch(&c->context, &p->context);
+      sched_run(c, p);
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       c->proc = 0;
@@ -697,6 +958,9 @@ void scheduler(void)
   {
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
+
+    uint64 start = r_time();
+    uint64 busy = c->busy;
     if (cfs)
     {
       cfs_scheduler(c);
@@ -705,6 +969,9 @@ void scheduler(void)
     {
       old_scheduler(c);
     }
+    // whatever part of this pass was not spent running
+    // a process was spent looking for one.
+    c->idle += (r_time() - start) - (c->busy - busy);
   }
 }
 
@@ -731,6 +998,8 @@ void sched(void)
 
   intena = mycpu()->intena;
   p->swapcount++;
+  // stop p's clock until the scheduler runs it again.
+  p->ru.stime += r_time() - p->tstamp;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
 }
@@ -804,12 +1073,102 @@ int sys_getswapcount(void)
   return myproc()->swapcount;
 }
 
+// Fold the current run-queue length into the load averages.
+// Called by clockintr() every LOAD_FREQ ticks. Reads p->state
+// without p->lock, since it runs in interrupt context; a
+// slightly stale count does not matter for an average.
+void calc_load(void)
+{
+  static const uint64 exp[3] = {EXP_1, EXP_5, EXP_15};
+  struct proc *p;
+  uint64 active = 0;
+
+  for (p = proc; p < &proc[NPROC]; p++)
+  {
+    if (p->state == RUNNABLE || p->state == RUNNING)
+      active++;
+  }
+  active *= FIXED_1;
+
+  for (int i = 0; i < 3; i++)
+  {
+    avenrun[i] = (avenrun[i] * exp[i] + active * (FIXED_1 - exp[i])) >> FSHIFT;
+  }
+}
+
+// Fill in *la with the load averages, the current run-queue
+// length and every CPU's busy/idle counters.
+void loadstat(struct loadavg *la)
+{
+  struct proc *p;
+
+  memset(la, 0, sizeof(*la));
+  for (int i = 0; i < 3; i++)
+    la->avg[i] = avenrun[i];
+
+  for (p = proc; p < &proc[NPROC]; p++)
+  {
+    acquire(&p->lock);
+    if (p->state != UNUSED)
+      la->nproc++;
+    if (p->state == RUNNING)
+      la->nrunning++;
+    else if (p->state == RUNNABLE)
+      la->nrunnable++;
+    release(&p->lock);
+  }
+
+  for (int i = 0; i < NCPU; i++)
+  {
+    la->cpu[i].busy = cpus[i].busy;
+    la->cpu[i].idle = cpus[i].idle;
+    if (cpus[i].busy + cpus[i].idle > 0)
+      la->ncpu = i + 1;
+  }
+
+  acquire(&tickslock);
+  la->ticks = ticks;
+  release(&tickslock);
+}
+
+// Copy out the resources used by the current process
+// (RUSAGE_SELF) or by its waited-for children (RUSAGE_CHILDREN).
+int getrusage(int who, uint64 addr)
+{
+  struct proc *p = myproc();
+  struct rusage ru;
+
+  if (who == RUSAGE_SELF)
+  {
+    // charge the system time of this call so far.
+    uint64 now = r_time();
+    p->ru.stime += now - p->tstamp;
+    p->tstamp = now;
+    ru = p->ru;
+  }
+  else if (who == RUSAGE_CHILDREN)
+  {
+    acquire(&wait_lock);
+    ru = p->cru;
+    release(&wait_lock);
+  }
+  else
+  {
+    return -1;
+  }
+
+  if (copyout(p->pagetable, addr, (char *)&ru, sizeof(ru)) < 0)
+    return -1;
+  return 0;
+}
+
 // Give up the CPU for one scheduling round.
 void yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  p->ru.nivcsw++;
   sched();
   release(&p->lock);
 }
@@ -835,6 +1194,19 @@ void forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk)
@@ -854,6 +1226,7 @@ void sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->ru.nvcsw++;
 
   sched();
 
@@ -885,6 +1258,49 @@ void wakeup(void *chan)
   }
 }
 
+// Memory has run out and nothing more can be reclaimed: kill the
+// process with the most user memory, unless it is already on its
+// way out, and give it a clock tick to exit. Returns 0 if the
+// caller should try to allocate again, or -1 if the caller has
+// been killed itself and should give up.
+int
+oomkill(void)
+{
+  struct proc *p, *victim = 0;
+  uint64 most = 0;
+  int pid = 0;
+  char name[sizeof(p->name)];
+
+  if(killed(myproc()))
+    return -1;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p != initproc && p->pagetable && p->kfn == 0 && p->state != ZOMBIE &&
+       p->sz > most){
+      victim = p;
+      most = p->sz;
+      pid = p->pid;
+      safestrcpy(name, p->name, sizeof(name));
+    }
+    release(&p->lock);
+  }
+  if(victim == 0)
+    return -1;
+  if(victim == myproc()){
+    printf("oomkill: killed pid %d (%s)\n", pid, name);
+    setkilled(victim);
+    return -1;
+  }
+  if(!killed(victim))
+    printf("oomkill: killed pid %d (%s)\n", pid, name);
+  kill(pid);
+
+  acquire(&tickslock);
+  sleep(&ticks, &tickslock);
+  release(&tickslock);
+  return 0;
+}
+
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
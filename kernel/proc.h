@@ -26,6 +26,12 @@ struct cpu
   struct context context; // swtch() here to enter scheduler().
   int noff;               // Depth of push_off() nesting.
   int intena;             // Were interrupts enabled before push_off()?
+  uint64 busy;            // time-CSR cycles spent running processes.
+  uint64 idle;            // time-CSR cycles spent with nothing to run.
+  uint64 asidgen;         // ASID generation the TLB was last flushed for.
+  uint64 kstackgen;       // kernel stacks mapped as of its last flush.
+  pagetable_t kpagetable; // SUMCOPY: this cpu's copy of the kernel page table.
+  struct proc *winproc;   // SUMCOPY: whose user memory kpagetable's window shows.
 };
 
 extern struct cpu cpus[NCPU];
@@ -82,6 +88,34 @@ struct trapframe
   /* 280 */ uint64 t6;
 };
 
+// A recent translation of one of a process's user pages, kept
+// so that copyin() and copyout() needn't walk the page table.
+struct wcache
+{
+  uint64 va;           // page-aligned
+  pte_t pte;           // leaf PTE for the page at va; 0 if empty
+};
+
+#define NWCACHE 8      // direct-mapped by page number
+
+// A region of a process's address space whose pages are filled
+// in by vmfault() on first touch, from a file or with zeroes.
+// Program segments lie below p->sz; mmap() regions lie above it.
+struct vma
+{
+  uint64 start;        // page-aligned
+  uint64 end;          // page-aligned; 0 if this slot is unused
+  int prot;            // PTE_R, PTE_W, PTE_X
+  int flags;           // VMA_MMAP, VMA_SHARED
+  struct inode *ip;    // backing file, or 0
+  struct shm *shm;     // backing shared-memory segment, or 0
+  uint64 off;          // file (or segment) offset of start
+  uint64 filesz;       // bytes of file from start; the rest reads as zero
+};
+
+#define VMA_MMAP   0x1  // made by mmap()
+#define VMA_SHARED 0x2  // MAP_SHARED: stores reach the file and other processes
+
 enum procstate
 {
   UNUSED,
@@ -105,7 +139,15 @@ struct proc
   int pid;              // Process ID
   int swapcount;        // Swap Count
   int nice;             // Nice value
+  int effnice;          // Nice value after priority inheritance
   int vruntime;         // Vruntime
+  uint64 tstamp;        // time CSR at the last user/kernel/switch transition
+  struct rusage ru;     // resources used by this process
+  struct rusage cru;    // resources used by waited-for children
+  struct sleeplock *held; // sleeplocks held, most recent first
+  void (*kfn)(void);    // body, if this is a kernel thread
+  int kpreempt;         // If non-zero, preempted in the kernel, maybe using its pages
+  uint64 swaphand;      // where swapout() looks for a page of this process next
 
   // wait_lock must be held when using this:
   struct proc *parent; // Parent process
@@ -114,8 +156,13 @@ struct proc
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  uint64 asid;                 // Address-space ID that tags pagetable's TLB entries
+  uint64 asidgen;              // Generation asid belongs to, 0 if none
+  int asidcpu;                 // cpu whose TLB last held asid's entries
+  struct wcache wcache[NWCACHE]; // Recent translations for copyin/copyout
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
+  struct vma vma[NVMA];        // Demand-paged regions
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
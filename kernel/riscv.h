@@ -9,6 +9,17 @@ r_mhartid()
   return x;
 }
 
+// Machine ISA Register, misa: one bit per extension letter.
+#define MISA_V (1L << ('V' - 'A'))  // vector extension
+
+static inline uint64
+r_misa()
+{
+  uint64 x;
+  asm volatile("csrr %0, misa" : "=r" (x) );
+  return x;
+}
+
 // Machine Status Register, mstatus
 
 #define MSTATUS_MPP_MASK (3L << 11) // previous mode.
@@ -47,6 +58,9 @@ w_mepc(uint64 x)
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
 #define SSTATUS_SIE (1L << 1)  // Supervisor Interrupt Enable
 #define SSTATUS_UIE (1L << 0)  // User Interrupt Enable
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User pages
+#define SSTATUS_VS (3L << 9)   // Vector unit state, 0=Off
+#define SSTATUS_VS_INITIAL (1L << 9)
 
 static inline uint64
 r_sstatus()
@@ -199,7 +213,7 @@ w_pmpaddr0(uint64 x)
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
-#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+#define MAKE_SATP(pagetable, asid) (SATP_SV39 | (((uint64)(asid)) << SATP_ASID_SHIFT) | (((uint64)pagetable) >> 12))
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -327,22 +341,48 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid) : "memory");
+}
+
+// flush the TLB entry for one page of one address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid) : "memory");
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
 #endif // __ASSEMBLER__
 
+// satp's address-space ID field, which tags TLB entries so that
+// switching satp need not flush them.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK 0xffff
+
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
 
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define MEGAPGSIZE (PGSIZE * 512) // bytes mapped by a level-1 leaf PTE
+#define MEGAORDER 9               // kalloc_pages() order of a megapage
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
+#define PTE_COW (1L << 8) // software: copy-on-write, read-only for now
+#define PTE_SHARED (1L << 9) // software: MAP_SHARED page, never COW
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -351,6 +391,17 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a PTE without PTE_V but with PTE_SWAP set says that its page
+// is in the swap slot numbered where the physical page number
+// would be; the other flags are the page's own.
+#define PTE_SWAP (1L << 63)
+#define SWAPPTE(slot, flags) ((((uint64)(slot)) << 10) | PTE_SWAP | ((flags) & ~PTE_V))
+#define PTE2SLOT(pte) (((pte) & ~PTE_SWAP) >> 10)
+
+// a valid PTE with any of R, W, X set maps memory rather than
+// pointing to the next level of page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
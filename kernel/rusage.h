@@ -0,0 +1,19 @@
+// Per-process resource usage, returned by getrusage() and wait4().
+// Both the kernel and user programs use this header file.
+
+#define RUSAGE_SELF      0
+#define RUSAGE_CHILDREN  (-1)
+
+// qemu's time CSR, which utime and stime are measured in, runs at 10 MHz.
+#define TIMEBASE_HZ      10000000
+
+struct rusage {
+  uint64 utime;      // time-CSR cycles spent in user mode
+  uint64 stime;      // time-CSR cycles spent in the kernel
+  uint nvcsw;        // voluntary context switches (sleep)
+  uint nivcsw;       // involuntary context switches (preempted)
+  uint inblock;      // disk blocks read by bread()
+  uint oublock;      // disk blocks written by bwrite()
+  uint minflt;       // page faults served without disk I/O
+  uint majflt;       // page faults that had to read the disk
+};
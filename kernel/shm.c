@@ -0,0 +1,196 @@
+//
+// Named shared-memory segments.
+//
+// shm_open() finds or creates a segment by name, shm_map() maps
+// all of it into the calling process with mmap(), and munmap()
+// removes it again. Every process that maps a segment sees the
+// same physical pages, which are allocated, zeroed, the first
+// time any of them touches a page. A segment goes away once it
+// has been shm_unlink()ed and nobody maps it any more.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "memstat.h"
+
+#define SHMNAME 16
+#define SHMMAXPAGES (PGSIZE / sizeof(void*))  // pages[] fits in one page
+
+struct shm {
+  char name[SHMNAME];
+  int used;           // slot in use
+  int unlinked;       // shm_unlink() has been called
+  int ref;            // mappings
+  int npages;
+  void **pages;       // one page of pointers, 0 until first touch
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+static struct shm*
+lookup(char *name)
+{
+  struct shm *sh;
+
+  for(sh = shmtable.shm; sh < shmtable.shm + NSHM; sh++)
+    if(sh->used && !sh->unlinked && strncmp(sh->name, name, SHMNAME) == 0)
+      return sh;
+  return 0;
+}
+
+// Free a segment's pages. Caller must hold shmtable.lock,
+// and nobody may map the segment.
+static void
+shmfree(struct shm *sh)
+{
+  for(int i = 0; i < sh->npages; i++)
+    if(sh->pages[i])
+      kfree(sh->pages[i]);
+  kfree((void*)sh->pages);
+  memset(sh, 0, sizeof(*sh));
+}
+
+// Return the id of the segment called name, creating it with
+// room for size bytes if there is none. Returns -1 on failure.
+int
+shmopen(char *name, int size)
+{
+  struct shm *sh;
+  void **pages;
+  int npages = PGROUNDUP((uint64)size) / PGSIZE;
+
+  // allocate before taking the lock, in case we create.
+  if((pages = kalloc_zeroed()) == 0)
+    return -1;
+
+  acquire(&shmtable.lock);
+  if((sh = lookup(name)) != 0){
+    release(&shmtable.lock);
+    kfree((void*)pages);
+    return sh - shmtable.shm;
+  }
+  if(size <= 0 || npages > SHMMAXPAGES)
+    goto bad;
+  for(sh = shmtable.shm; sh < shmtable.shm + NSHM; sh++){
+    if(!sh->used){
+      safestrcpy(sh->name, name, SHMNAME);
+      sh->used = 1;
+      sh->npages = npages;
+      sh->pages = pages;
+      release(&shmtable.lock);
+      return sh - shmtable.shm;
+    }
+  }
+
+ bad:
+  release(&shmtable.lock);
+  kfree((void*)pages);
+  return -1;
+}
+
+// Remove name, so that shm_open() creates a new segment. The
+// segment itself lives until its last mapping goes away.
+int
+shmunlink(char *name)
+{
+  struct shm *sh;
+
+  acquire(&shmtable.lock);
+  if((sh = lookup(name)) == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  sh->unlinked = 1;
+  if(sh->ref == 0)
+    shmfree(sh);
+  release(&shmtable.lock);
+  return 0;
+}
+
+// Take a reference to segment id for a new mapping, and return
+// it and its size in bytes. Returns 0 if there is no such segment.
+struct shm*
+shmget(int id, uint64 *size)
+{
+  struct shm *sh;
+
+  if(id < 0 || id >= NSHM)
+    return 0;
+  sh = &shmtable.shm[id];
+  acquire(&shmtable.lock);
+  if(!sh->used || sh->unlinked){
+    release(&shmtable.lock);
+    return 0;
+  }
+  sh->ref++;
+  *size = (uint64)sh->npages * PGSIZE;
+  release(&shmtable.lock);
+  return sh;
+}
+
+// Take another reference to a mapped segment.
+void
+shmdup(struct shm *sh)
+{
+  acquire(&shmtable.lock);
+  if(sh->ref < 1)
+    panic("shmdup");
+  sh->ref++;
+  release(&shmtable.lock);
+}
+
+// Drop a reference, freeing the segment if it was the last
+// one and the segment has been unlinked.
+void
+shmput(struct shm *sh)
+{
+  acquire(&shmtable.lock);
+  if(sh->ref < 1)
+    panic("shmput");
+  if(--sh->ref == 0 && sh->unlinked)
+    shmfree(sh);
+  release(&shmtable.lock);
+}
+
+// Return page i of a mapped segment, allocating it if nobody
+// has touched it yet, with a reference for the caller's mapping.
+// Returns 0 if out of memory or i is past the end.
+void*
+shmpage(struct shm *sh, int i)
+{
+  void *pa, *mem = 0;
+
+  if(i < 0 || i >= sh->npages)
+    return 0;
+  for(;;){
+    acquire(&shmtable.lock);
+    if((pa = sh->pages[i]) == 0 && mem){
+      sh->pages[i] = pa = mem;
+      mem = 0;
+    }
+    if(pa)
+      kref(pa);
+    release(&shmtable.lock);
+    if(pa)
+      break;
+    // allocate outside the lock and try again.
+    if((mem = kalloc_zeroed()) == 0)
+      return 0;
+    kpgtype(mem, MEM_USER);
+  }
+  if(mem)
+    kfree(mem);
+  return pa;
+}
@@ -6,6 +6,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "sleeplock.h"
 
@@ -16,26 +17,93 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->holder = 0;
+  lk->waitnice = 20;
+  lk->nextheld = 0;
+}
+
+// Recompute p's effective nice: its own nice value, or that of
+// the most important process waiting for a sleeplock p holds,
+// whichever is lower. p->lock must be held; waiters change the
+// waitnice of a lock p holds, and p->effnice, only with it held
+// too, so a loan can't be lost between the two.
+void
+inheritprio(struct proc *p)
+{
+  struct sleeplock *lk;
+  int nice = p->nice;
+
+  if(!holding(&p->lock))
+    panic("inheritprio");
+
+  for(lk = p->held; lk; lk = lk->nextheld)
+    if(lk->waitnice < nice)
+      nice = lk->waitnice;
+  p->effnice = nice;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *p = myproc();
+  struct proc *h;
+  int nice;
+
   acquire(&lk->lk);
   while (lk->locked) {
+    // lend our priority to the holder, so that a low-priority
+    // holder is not starved by medium-priority processes while
+    // we wait. releasesleep() wakes every waiter, so each one
+    // renews the loan to the next holder. the holder's lock
+    // orders this with its inheritprio().
+    nice = p->effnice;
+    if((h = lk->holder) != 0){
+      acquire(&h->lock);
+      if(nice < lk->waitnice)
+        lk->waitnice = nice;
+      if(nice < h->effnice)
+        h->effnice = nice;
+      release(&h->lock);
+    }
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
-  lk->pid = myproc()->pid;
+  lk->pid = p->pid;
+  lk->holder = p;
+  acquire(&p->lock);
+  lk->nextheld = p->held;
+  p->held = lk;
+  release(&p->lock);
   release(&lk->lk);
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
+  struct proc *p;
+  struct sleeplock **pp;
+
   acquire(&lk->lk);
+  p = lk->holder;
   lk->locked = 0;
   lk->pid = 0;
+  lk->holder = 0;
+  if(p){
+    acquire(&p->lock);
+    lk->waitnice = 20;
+    for(pp = &p->held; *pp; pp = &(*pp)->nextheld){
+      if(*pp == lk){
+        *pp = lk->nextheld;
+        break;
+      }
+    }
+    // drop whatever priority lk's waiters lent us.
+    inheritprio(p);
+    release(&p->lock);
+  } else {
+    lk->waitnice = 20;
+  }
+  lk->nextheld = 0;
   wakeup(lk);
   release(&lk->lk);
 }
@@ -2,6 +2,11 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+
+  // For priority inheritance:
+  struct proc *holder;        // Process holding lock
+  int waitnice;               // Lowest nice of any waiter, 20 if none
+  struct sleeplock *nextheld; // Next lock in holder->held
   
   // For debugging:
   char *name;        // Name of lock.
@@ -16,6 +16,11 @@ uint64 timer_scratch[NCPU][5];
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
+#ifdef RVV
+// string.c uses the vector unit if there is one.
+extern int rvv;
+#endif
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -43,9 +48,18 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // allow supervisor mode to read the time CSR,
+  // for the scheduler's busy/idle accounting.
+  w_mcounteren(r_mcounteren() | 2);
+
   // ask for clock interrupts.
   timerinit();
 
+#ifdef RVV
+  if(r_misa() & MISA_V)
+    rvv = 1;
+#endif
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
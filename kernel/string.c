@@ -1,13 +1,77 @@
 #include "types.h"
+#include "riscv.h"
+#include "defs.h"
+
+// memset, memmove and memcmp go a 64-bit word at a time, four
+// words per loop, once their pointers are aligned; only the ends,
+// and pointers that can never be aligned together, go byte by byte.
+
+#define WSIZE 8
+#define WMASK (WSIZE - 1)
+
+#ifdef RVV
+// a kernel made with RVV=1 hands big aligned-together blocks to
+// the vector unit (vstring.S) if start() found one.
+int rvv;
+
+#define VMIN 256  // smaller blocks aren't worth the sstatus writes
+
+void vmemset(void*, int, uint);
+void vmemcpy(void*, const void*, uint);
+
+// Run the vector unit only with interrupts off, so that nothing
+// else can use the vector registers under us, and only while we
+// need it, so that user code can't see what we left in them.
+static void
+vstart(void)
+{
+  push_off();
+  w_sstatus(r_sstatus() | SSTATUS_VS_INITIAL);
+}
+
+static void
+vstop(void)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  pop_off();
+}
+#endif
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+#ifdef RVV
+  if(rvv && n >= VMIN){
+    vstart();
+    vmemset(dst, c, n);
+    vstop();
+    return dst;
+  }
+#endif
+
+  while(n > 0 && ((uint64)cdst & WMASK) != 0){
+    *cdst++ = c;
+    n--;
   }
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wdst = (uint64 *) cdst;
+  for(; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4){
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
+  }
+  for(; n >= WSIZE; n -= WSIZE)
+    *wdst++ = w;
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +82,19 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & WMASK) == 0){
+    while(n > 0 && ((uint64)s1 & WMASK) != 0){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip the equal words; the bytes of the first differing
+    // one are compared below.
+    while(n >= WSIZE && *(uint64*)s1 == *(uint64*)s2){
+      s1 += WSIZE, s2 += WSIZE;
+      n -= WSIZE;
+    }
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,20 +109,71 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const uint64 *ws;
+  uint64 *wd;
+  int aligned;
 
   if(n == 0)
     return dst;
-  
+
   s = src;
   d = dst;
+  aligned = (((uint64)s ^ (uint64)d) & WMASK) == 0;
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(aligned){
+      while(n > 0 && ((uint64)d & WMASK) != 0){
+        *--d = *--s;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE){
+        ws -= 4, wd -= 4;
+        wd[3] = ws[3];
+        wd[2] = ws[2];
+        wd[1] = ws[1];
+        wd[0] = ws[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+#ifdef RVV
+    // copying forward a vector at a time is safe when d < s.
+    if(rvv && aligned && n >= VMIN){
+      vstart();
+      vmemcpy(d, s, n);
+      vstop();
+      return dst;
+    }
+#endif
+    if(aligned){
+      while(n > 0 && ((uint64)d & WMASK) != 0){
+        *d++ = *s++;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, ws += 4, wd += 4){
+        wd[0] = ws[0];
+        wd[1] = ws[1];
+        wd[2] = ws[2];
+        wd[3] = ws[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
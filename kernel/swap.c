@@ -0,0 +1,224 @@
+//
+// Swap space: anonymous pages paged out to the disk.
+//
+// The swap area is NSWAP page-sized slots on the virtio disk,
+// just past the file system. When memory runs short, a page
+// fault calls swapout(), which sweeps the processes' page
+// tables with uvmclock() for a private page that hasn't been
+// used lately, writes it to a free slot, and replaces its PTE
+// with one that names the slot (PTE_SWAP). Touching the page
+// again faults, and vmfault() calls swapin() to read it back.
+//
+// The kswapd kernel thread does the same ahead of time, along
+// with reclaiming the caches' pages, whenever fewer than
+// WMARK_LOW pages are free.
+//
+// A slot remembers its page until the write is done, so that
+// a fault that comes while it is in flight just takes the page
+// back. fork() shares a slot between parent and child, which
+// each read their own copy of it in.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "fs.h"
+
+#define NROUND 3   // sweeps over all processes before giving up
+
+struct slot {
+  int ref;      // PTEs that name this slot
+  int busy;     // being written
+  void *pa;     // the page, until it is written
+};
+
+struct {
+  struct spinlock lock;
+  struct slot slot[NSWAP];
+  int hand;     // process that swapout() looks at next
+} swap;
+
+extern struct proc proc[NPROC];
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+}
+
+// Whether swapout() may take pages from p, whose lock is held.
+// A process preempted in the kernel may be in the middle of
+// using one of its user pages through the direct map.
+static int
+evictable(struct proc *p)
+{
+  if(p->pagetable == 0 || p->kfn)
+    return 0;
+  if(p == myproc())
+    return 1;
+  return (p->state == SLEEPING || p->state == RUNNABLE) && !p->kpreempt;
+}
+
+static uint
+slotblock(int s)
+{
+  return SWAPSTART + s * (PGSIZE / BSIZE);
+}
+
+// Write a page of some process's out to swap, and free it.
+// Returns 0 if a page was freed, -1 if no process has a page
+// to spare or the swap area is full.
+int
+swapout(void)
+{
+  struct proc *p;
+  struct slot *sl;
+  pte_t *pte;
+  void *pa;
+  int s;
+
+  for(int i = 0; i < NROUND * NPROC; i++){
+    acquire(&swap.lock);
+    p = &proc[swap.hand];
+    swap.hand = (swap.hand + 1) % NPROC;
+    release(&swap.lock);
+
+    acquire(&p->lock);
+    if(!evictable(p) || (pte = uvmclock(p)) == 0){
+      release(&p->lock);
+      continue;
+    }
+    acquire(&swap.lock);
+    for(s = 0; s < NSWAP; s++)
+      if(swap.slot[s].ref == 0 && !swap.slot[s].busy && swap.slot[s].pa == 0)
+        break;
+    if(s == NSWAP){
+      release(&swap.lock);
+      release(&p->lock);
+      return -1;
+    }
+    sl = &swap.slot[s];
+    pa = (void*)PTE2PA(*pte);
+    sl->ref = 1;
+    sl->busy = 1;
+    sl->pa = pa;   // the PTE's reference to pa is now the slot's
+    kref(pa);      // and this one keeps pa while it is being written
+    release(&swap.lock);
+    *pte = SWAPPTE(s, PTE_FLAGS(*pte));
+    uvmflush(p, -1);
+    release(&p->lock);
+
+    virtio_disk_rwpage(slotblock(s), pa, 1);
+    acquire(&swap.lock);
+    sl->busy = 0;
+    if(sl->pa == pa){
+      sl->pa = 0;
+      kfree(pa);
+    }
+    release(&swap.lock);
+    kfree(pa);
+    return 0;
+  }
+  return -1;
+}
+
+// Bring the page that *pte says is in swap back into memory for
+// the current process, and map it. Returns 0 on success, -1 if
+// there is no memory.
+int
+swapin(pte_t *pte)
+{
+  struct proc *p = myproc();
+  int s = PTE2SLOT(*pte);
+  struct slot *sl = &swap.slot[s];
+  int flags = PTE_FLAGS(*pte) | PTE_V;
+  char *mem = 0;
+
+  acquire(&swap.lock);
+  if(sl->ref == 1 && sl->pa){
+    // nobody else wants it, and it is still here.
+    mem = sl->pa;
+    sl->pa = 0;
+  }
+  release(&swap.lock);
+
+  if(mem){
+    p->ru.minflt++;
+  } else {
+    if((mem = uvmkalloc(0)) == 0)
+      return -1;
+    acquire(&swap.lock);
+    if(sl->pa){
+      memmove(mem, sl->pa, PGSIZE);
+      release(&swap.lock);
+      p->ru.minflt++;
+    } else {
+      release(&swap.lock);
+      virtio_disk_rwpage(slotblock(s), mem, 0);
+      p->ru.majflt++;
+    }
+  }
+
+  swapfree(s);
+  *pte = PA2PTE(mem) | flags;
+  return 0;
+}
+
+// Another PTE names slot s, after fork().
+void
+swapdup(int s)
+{
+  acquire(&swap.lock);
+  swap.slot[s].ref++;
+  release(&swap.lock);
+}
+
+// A PTE that named slot s is gone.
+void
+swapfree(int s)
+{
+  struct slot *sl = &swap.slot[s];
+
+  acquire(&swap.lock);
+  if(--sl->ref == 0 && sl->pa){
+    kfree(sl->pa);
+    sl->pa = 0;
+  }
+  release(&swap.lock);
+}
+
+// Number of swap slots in use.
+int
+swapused(void)
+{
+  int n = 0;
+
+  acquire(&swap.lock);
+  for(int s = 0; s < NSWAP; s++)
+    if(swap.slot[s].ref > 0 || swap.slot[s].busy)
+      n++;
+  release(&swap.lock);
+  return n;
+}
+
+// Body of the kswapd kernel thread: every clock tick, if fewer
+// than WMARK_LOW pages are free, take back pages from the caches
+// and swap pages out until WMARK_HIGH are, so that processes
+// seldom have to wait for it in a page fault.
+void
+kswapd(void)
+{
+  for(;;){
+    if(kfreepages() < WMARK_LOW)
+      while(kfreepages() < WMARK_HIGH && (kreclaim() > 0 || swapout() == 0))
+        ;
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+  }
+}
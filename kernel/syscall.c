@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
@@ -106,6 +107,18 @@ extern uint64 sys_nice(void);
 extern uint64 sys_startcfs(void);
 extern uint64 sys_stopcfs(void);
 
+extern uint64 sys_getload(void);
+extern uint64 sys_wait4(void);
+extern uint64 sys_getrusage(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_shm_open(void);
+extern uint64 sys_shm_map(void);
+extern uint64 sys_shm_unlink(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_spawn(void);
+
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
 static uint64 (*syscalls[])(void) = {
@@ -136,6 +149,17 @@ static uint64 (*syscalls[])(void) = {
     [SYS_nice] sys_nice,
     [SYS_startcfs] sys_startcfs,
     [SYS_stopcfs] sys_stopcfs,
+    [SYS_getload] sys_getload,
+    [SYS_wait4] sys_wait4,
+    [SYS_getrusage] sys_getrusage,
+    [SYS_mmap] sys_mmap,
+    [SYS_munmap] sys_munmap,
+    [SYS_shm_open] sys_shm_open,
+    [SYS_shm_map] sys_shm_map,
+    [SYS_shm_unlink] sys_shm_unlink,
+    [SYS_memstat] sys_memstat,
+    [SYS_madvise] sys_madvise,
+    [SYS_spawn] sys_spawn,
 };
 
 void syscall(void)
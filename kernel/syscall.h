@@ -28,3 +28,15 @@
 #define SYS_nice 25 
 #define SYS_startcfs 26
 #define SYS_stopcfs 27
+
+#define SYS_getload 28
+#define SYS_wait4 29
+#define SYS_getrusage 30
+#define SYS_mmap 31
+#define SYS_munmap 32
+#define SYS_shm_open 33
+#define SYS_shm_map 34
+#define SYS_shm_unlink 35
+#define SYS_memstat 36
+#define SYS_madvise 37
+#define SYS_spawn 38
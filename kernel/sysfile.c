@@ -10,11 +10,13 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -431,20 +433,26 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Free the strings fetchargv() copied.
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Copy the array of argument strings at user address uargv
+// into argv[MAXARG], a kalloc()ed page per string.
+// Returns 0 on success, -1 with nothing left allocated.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG * sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -460,18 +468,60 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = exec(path, argv);
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
 
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0 || fetchargv(uargv, argv) < 0)
+    return -1;
+  ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fds): run a program in a new child process.
+// The child's descriptor i is the caller's fds[i], or the caller's
+// own i if fds is 0 or fds[i] is -1.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv, ufds;
+  int fds[3], ret;
+  struct file *f[3];
+  struct proc *p = myproc();
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufds);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  for(int i = 0; i < 3; i++)
+    fds[i] = -1;
+  if(ufds && copyin(p->pagetable, (char*)fds, ufds, sizeof(fds)) < 0)
+    return -1;
+  for(int i = 0; i < 3; i++){
+    if(fds[i] < 0)
+      fds[i] = i;
+    if(fds[i] >= NOFILE)
+      return -1;
+    f[i] = p->ofile[fds[i]];
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+  ret = spawn(path, argv, f);
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -503,3 +553,53 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len;
+  int prot, flags, off, share;
+  struct file *f;
+  struct inode *ip = 0;
+
+  argaddr(0, &addr);  // only a hint; mmap() chooses the address
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  share = flags & (MAP_SHARED|MAP_PRIVATE);
+  if(share != MAP_SHARED && share != MAP_PRIVATE)
+    return -1;
+  if(off < 0 || off % PGSIZE != 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if(share == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+    ip = f->ip;
+  }
+  return mmap(len, prot, flags, ip, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
+
+uint64
+sys_madvise(void)
+{
+  uint64 addr, len;
+  int advice;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &advice);
+  return madvise(addr, len, advice);
+}
@@ -4,7 +4,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
+#include "loadavg.h"
+#include "memstat.h"
 
 uint64
 sys_exit(void)
@@ -35,6 +38,29 @@ sys_wait(void)
   return wait(p);
 }
 
+uint64
+sys_wait4(void)
+{
+  int pid;
+  uint64 p, ru;
+
+  argint(0, &pid);
+  argaddr(1, &p);
+  argaddr(2, &ru);
+  return wait4(pid, p, ru);
+}
+
+uint64
+sys_getrusage(void)
+{
+  int who;
+  uint64 ru;
+
+  argint(0, &who);
+  argaddr(1, &ru);
+  return getrusage(who, ru);
+}
+
 uint64
 sys_sbrk(void)
 {
@@ -89,3 +115,70 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// return the load averages and per-CPU utilization.
+uint64
+sys_getload(void)
+{
+  uint64 addr;
+  struct loadavg la;
+
+  argaddr(0, &addr);
+  loadstat(&la);
+  if(copyout(myproc()->pagetable, addr, (char *)&la, sizeof(la)) < 0)
+    return -1;
+  return 0;
+}
+
+// return counts of free and allocated physical pages.
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+  struct memstat ms;
+
+  argaddr(0, &addr);
+  kmemstat(&ms);
+  ms.pcache = pcachepages();
+  ms.swaptotal = NSWAP;
+  ms.swapused = swapused();
+  ms.nbuf = NBUF;
+  ms.npipe = pipecount();
+  if(copyout(myproc()->pagetable, addr, (char *)&ms, sizeof(ms)) < 0)
+    return -1;
+  return 0;
+}
+
+// find or create a named shared-memory segment.
+uint64
+sys_shm_open(void)
+{
+  char name[16];
+  int size;
+
+  if(argstr(0, name, sizeof(name)) < 0)
+    return -1;
+  argint(1, &size);
+  return shmopen(name, size);
+}
+
+// map a shared-memory segment into this process.
+uint64
+sys_shm_map(void)
+{
+  int id;
+
+  argint(0, &id);
+  return shmmap(id);
+}
+
+// remove a shared-memory segment's name.
+uint64
+sys_shm_unlink(void)
+{
+  char name[16];
+
+  if(argstr(0, name, sizeof(name)) < 0)
+    return -1;
+  return shmunlink(name);
+}
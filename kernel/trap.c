@@ -3,8 +3,10 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
+#include "loadavg.h"
 
 struct spinlock tickslock;
 uint ticks;
@@ -14,6 +16,33 @@ extern char trampoline[], uservec[], userret[];
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
+#ifdef SUMCOPY
+// kernel code that touches user memory directly and may fault
+// doing it, and where to go instead if it does; see usercopy.S.
+extern char ucopystart[], ucopyend[], ucopyfault[];
+
+struct fixup {
+  char *start, *end;   // [start, end) may fault
+  char *fixup;
+} fixups[] = {
+  { ucopystart, ucopyend, ucopyfault },
+};
+#endif
+
+// Return the address to resume at after a page fault at sepc
+// in kernel code that expects it, or 0 if the fault is a bug.
+static uint64
+fixup(uint64 sepc, uint64 scause)
+{
+#ifdef SUMCOPY
+  if(scause == 13 || scause == 15)
+    for(struct fixup *f = fixups; f < fixups + NELEM(fixups); f++)
+      if(sepc >= (uint64)f->start && sepc < (uint64)f->end)
+        return (uint64)f->fixup;
+#endif
+  return 0;
+}
+
 extern int devintr();
 
 void
@@ -46,6 +75,11 @@ usertrap(void)
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+
+  // charge the time since usertrapret() to user mode.
+  uint64 now = r_time();
+  p->ru.utime += now - p->tstamp;
+  p->tstamp = now;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -67,6 +101,10 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            vmfault(p->pagetable, r_stval(), r_scause() == 15) == 0){
+    // page fault on a lazily allocated or copy-on-write page;
+    // retry the instruction.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -96,6 +134,11 @@ usertrapret(void)
   // we're back in user space, where usertrap() is correct.
   intr_off();
 
+  // charge the time since usertrap() to the kernel.
+  uint64 now = r_time();
+  p->ru.stime += now - p->tstamp;
+  p->tstamp = now;
+
   // send syscalls, interrupts, and exceptions to uservec in trampoline.S
   uint64 trampoline_uservec = TRAMPOLINE + (uservec - trampoline);
   w_stvec(trampoline_uservec);
@@ -119,8 +162,9 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // tagged with p's address-space ID.
+  uint64 satp = uvmsatp(p);
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -144,15 +188,20 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((which_dev = devintr()) == 0 && (sepc = fixup(sepc, scause)) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // give up the CPU if this is a timer interrupt. until it
+  // runs again, swapout() leaves the process's pages alone,
+  // since the kernel code it was running might be using them.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING){
+    myproc()->kpreempt = 1;
     yield();
+    myproc()->kpreempt = 0;
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -165,6 +214,8 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
+  if(ticks % LOAD_FREQ == 0)
+    calc_load();
   wakeup(&ticks);
   release(&tickslock);
 }
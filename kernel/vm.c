@@ -5,6 +5,10 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "memstat.h"
 
 /*
  * the kernel's page table.
@@ -15,14 +19,36 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// Address-space IDs. Each process runs with an ASID in satp,
+// so that the TLB can hold its entries and the kernel's (ASID
+// 0) at the same time, and traps need not flush it. ASIDs are
+// handed out in order; once they run out a new generation
+// starts, and each hart flushes its whole TLB before running
+// a process with an ASID of the new generation. maxasid is 0
+// if the hardware implements no ASID bits, in which case
+// trampoline.S flushes the TLB on every switch.
+struct {
+  struct spinlock lock;
+  uint64 gen;
+  uint64 next;
+} asids;
+
+uint64 maxasid;
+
+#ifdef SUMCOPY
+// in usercopy.S.
+int ucopy(void*, const void*, uint64);
+int ucopystr(char*, const char*, uint64);
+#endif
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
+  kpgtype(kpgtbl, MEM_PAGETABLE);
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -43,7 +69,7 @@ kvmmake(void)
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
+  // make room for a kernel stack for each process.
   proc_mapstacks(kpgtbl);
   
   return kpgtbl;
@@ -54,6 +80,9 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  initlock(&asids.lock, "asid");
+  asids.gen = 1;
+  asids.next = 1;
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -61,18 +90,226 @@ kvminit(void)
 void
 kvminithart()
 {
+  pagetable_t kpgtbl = kernel_pagetable;
+
+#ifdef SUMCOPY
+  // each hart gets its own root page-table page, so that the
+  // upper half can hold the window onto its process's memory.
+  struct cpu *c = mycpu();
+  if((c->kpagetable = (pagetable_t)kalloc()) == 0)
+    panic("kvminithart");
+  kpgtype(c->kpagetable, MEM_PAGETABLE);
+  memmove(c->kpagetable, kernel_pagetable, PGSIZE);
+  kpgtbl = c->kpagetable;
+#endif
+
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  // find out how many ASID bits are implemented: they are the
+  // ones that stick when all are written as ones.
+  w_satp(MAKE_SATP(kpgtbl, SATP_ASID_MASK));
+  maxasid = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+
+  w_satp(MAKE_SATP(kpgtbl, 0));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Return the satp value that runs the current process p in user
+// space, giving p an ASID of the current generation if it doesn't
+// have one. The TLB of this hart may hold stale entries of p's
+// ASID if p last ran elsewhere, or of an older generation's use
+// of it, so flush those. Called with interrupts off.
+uint64
+uvmsatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+
+  if(maxasid == 0)
+    return MAKE_SATP(p->pagetable, 0);
+
+  if(p->asidgen != __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE)){
+    acquire(&asids.lock);
+    if(asids.next > maxasid){
+      asids.gen++;
+      asids.next = 1;
+    }
+    p->asid = asids.next++;
+    p->asidgen = asids.gen;
+    release(&asids.lock);
+  }
+
+  if(c->asidgen != p->asidgen){
+    sfence_vma();
+    c->asidgen = p->asidgen;
+    p->asidcpu = id;
+  } else if(p->asidcpu != id){
+    sfence_vma_asid(p->asid);
+    p->asidcpu = id;
+  }
+  return MAKE_SATP(p->pagetable, p->asid);
+}
+
+// Make p use a fresh ASID the next time it returns to user
+// space, because its TLB entries no longer match its page
+// table, e.g. after exec() replaces it.
+void
+asidinval(struct proc *p)
+{
+  p->asidgen = 0;
+  memset(p->wcache, 0, sizeof(p->wcache));
+  if(p == myproc())
+    uwinclose();
+}
+
+// The user window. A kernel made with SUMCOPY=1 maps the current
+// process's user memory at UWINDOW in the upper half of each
+// hart's kernel page table, by pointing the window's root PTEs
+// at the user page table's level-1 pages, and copyin(), copyout()
+// and copyinstr() reach user memory through it with sstatus.SUM
+// set, instead of walking the user page table in software. A copy
+// that faults, on a page that isn't mapped or isn't writable yet,
+// is abandoned through the fixup table in trap.c, and redone the
+// slow way, which calls vmfault().
+//
+// The window is opened for a process by its first copy after it
+// starts running on a hart, and closed when it stops, or when its
+// page table changes, so its TLB entries (ASID 0, like the rest
+// of the kernel's) are flushed before it is opened again.
+
+// Unmap the window of this hart's kernel page table.
+void
+uwinclose(void)
+{
+#ifdef SUMCOPY
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  if(c->winproc){
+    memset(&c->kpagetable[PX(2, UWINDOW)], 0, (512 - PX(2, UWINDOW)) * sizeof(pte_t));
+    c->winproc = 0;
+  }
+  pop_off();
+#endif
+}
+
+#ifdef SUMCOPY
+// Open this hart's window onto pagetable, which must be the
+// current process's, for user addresses [u, u+n). The caller
+// must have interrupts off, which keeps the window its own.
+// Returns 0 if the window can be used, -1 if not.
+static int
+uwinopen(pagetable_t pagetable, uint64 u, uint64 n)
+{
+  struct proc *p = myproc();
+  struct cpu *c = mycpu();
+
+  // the trapframe and trampoline pages aren't the user's.
+  if(p == 0 || pagetable != p->pagetable || u + n < u || u + n > TRAPFRAME)
+    return -1;
+  if(c->winproc != p){
+    for(int i = 0; i < PX(2, UWINDOW); i++)
+      c->kpagetable[PX(2, UWINDOW) + i] = pagetable[i];
+    sfence_vma_asid(0);
+    c->winproc = p;
+  }
+  return 0;
+}
+#endif
+
+// Flush this hart's TLB entries for pagetable, or for just the
+// page at va if va is not -1, after changing a PTE of it, and the
+// owner's walk cache, which is like a TLB that only copyin() and
+// copyout() use. Only
+// the current process's page table can be in use in user space
+// on this hart; whoever changes a page table that another process
+// has run with must call asidinval() instead.
+static void
+tlbflush(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || pagetable != p->pagetable){
+    if(pagetable == kernel_pagetable)
+      sfence_vma();
+    return;
+  }
+  uwinclose();
+  if(va == -1)
+    memset(p->wcache, 0, sizeof(p->wcache));
+  else if(p->wcache[(va >> PGSHIFT) % NWCACHE].va == va)
+    p->wcache[(va >> PGSHIFT) % NWCACHE].pte = 0;
+  if(maxasid == 0 || p->asidgen == 0){
+    // no ASID of p's is in the TLB.
+  } else if(va == -1){
+    sfence_vma_asid(p->asid);
+  } else {
+    sfence_vma_page(va, p->asid);
+  }
+}
+
+// Replace the leaf PTE *pte at the given level, a megapage if
+// level is 1, with a pointer to a new page-table page of leaves
+// that map the same memory with the same permissions.
+// Returns 0 on success, -1 if out of memory.
+static int
+ptesplit(pte_t *pte, int level)
+{
+  pagetable_t pt;
+  uint64 pa = PTE2PA(*pte);
+  uint64 flags = PTE_FLAGS(*pte);
+
+  if((pt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  kpgtype(pt, MEM_PAGETABLE);
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + ((uint64)i << PXSHIFT(level-1))) | flags;
+  *pte = PA2PTE(pt) | PTE_V;
+  return 0;
+}
+
+// Return the address of the PTE at the given level of page table
+// pagetable that corresponds to virtual address va. Leaves above
+// that level are split on the way down. If alloc!=0, create any
+// required page-table pages. Returns 0 if a page-table page is
+// missing, or can't be allocated.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int level, int alloc)
+{
+  if(va >= MAXVA)
+    panic("walk");
+
+  pagetable_t root = pagetable;
+
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        if(ptesplit(pte, l) != 0)
+          return 0;
+        tlbflush(root, -1);
+      }
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
+        return 0;
+      kpgtype(pagetable, MEM_PAGETABLE);
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  return &pagetable[PX(level, va)];
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// create any required page-table pages. A megapage
+// that covers va is transparently split into 4096-byte
+// pages first, so the result is always a level-0 PTE;
+// walk() returns 0 if that needs memory it can't get.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -85,44 +322,74 @@ kvminithart()
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
-  if(va >= MAXVA)
-    panic("walk");
+  return walklevel(pagetable, va, 0, alloc);
+}
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
-    } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
-        return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
+// Return the leaf PTE that maps va, at whatever level it is,
+// and set *level to that level. Never splits or allocates.
+// Returns 0 if va is not mapped.
+pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, int *level)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  for(int l = 2; l >= 0; l--){
+    pte = &pagetable[PX(l, va)];
+    if((*pte & PTE_V) == 0)
+      return 0;
+    if(PTE_LEAF(*pte) || l == 0){
+      *level = l;
+      return pte;
     }
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  return 0;
+}
+
+// Return a copy of the leaf PTE that maps the page at va in
+// pagetable, with the physical address of just that page if
+// the leaf is a megapage, or 0 if it is not mapped. Lookups in
+// the current process's page table go through its walk cache.
+static pte_t
+uvmlookup(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct wcache *w = 0;
+  pte_t *pte, leaf;
+  int level;
+
+  va = PGROUNDDOWN(va);
+  if(p && pagetable == p->pagetable){
+    w = &p->wcache[(va >> PGSHIFT) % NWCACHE];
+    if(w->pte && w->va == va)
+      return w->pte;
+  }
+  if((pte = walkleaf(pagetable, va, &level)) == 0)
+    return 0;
+  leaf = PA2PTE(PTE2PA(*pte) + (va & ((1L << PXSHIFT(level)) - 1))) | PTE_FLAGS(*pte);
+  if(w){
+    w->va = va;
+    w->pte = leaf;
   }
-  return &pagetable[PX(0, va)];
+  return leaf;
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
+// Look up a virtual address, return the physical address
+// of the page that holds it, or 0 if not mapped.
 // Can only be used to look up user pages.
 uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
-  pte_t *pte;
-  uint64 pa;
+  pte_t pte;
 
-  if(va >= MAXVA)
+  pte = uvmlookup(pagetable, va);
+  if((pte & PTE_V) == 0)
     return 0;
-
-  pte = walk(pagetable, va, 0);
-  if(pte == 0)
+  if((pte & PTE_U) == 0)
     return 0;
-  if((*pte & PTE_V) == 0)
-    return 0;
-  if((*pte & PTE_U) == 0)
-    return 0;
-  pa = PTE2PA(*pte);
-  return pa;
+  return PTE2PA(pte);
 }
 
 // add a mapping to the kernel page table.
@@ -135,9 +402,57 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
     panic("kvmmap");
 }
 
+// Kernel stacks mapped so far; see kvmstackfence().
+static uint64 kstackgen;
+
+// Map a new kernel stack page at va in the kernel page table,
+// unless one is there already. proc_mapstacks() made the page-
+// table pages at boot, so every hart's copy of the root shares
+// the new PTE, but a hart may have cached va as invalid: each one
+// fences in kvmstackfence() before it next switches to a process.
+// Stacks are never unmapped, since other harts' TLBs could not
+// be told.
+// Returns 0 on success, -1 if out of memory.
+int
+kvmstack(uint64 va)
+{
+  pte_t *pte;
+  char *pa;
+
+  if((pte = walk(kernel_pagetable, va, 0)) == 0)
+    panic("kvmstack");
+  if(*pte & PTE_V)
+    return 0;
+  if((pa = kalloc()) == 0)
+    return -1;
+  kpgtype(pa, MEM_KSTACK);
+  *pte = PA2PTE(pa) | PTE_R | PTE_W | PTE_V;
+  sfence_vma();
+  __atomic_add_fetch(&kstackgen, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Called by the scheduler before it switches to a process, whose
+// kernel stack may have been mapped by another hart: flush this
+// hart's TLB if any stack has been mapped since it last did.
+void
+kvmstackfence(void)
+{
+  struct cpu *c = mycpu();
+  uint64 gen = __atomic_load_n(&kstackgen, __ATOMIC_ACQUIRE);
+
+  if(c->kstackgen != gen){
+    c->kstackgen = gen;
+    sfence_vma();
+  }
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Where va and pa are both 2-megabyte aligned
+// and at least that much is left to map, uses a single megapage
+// PTE, unless a page-table page is already in the way.
+// Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
@@ -151,6 +466,16 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    if(a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE &&
+       (pte = walklevel(pagetable, a, 1, 1)) != 0 && (*pte & PTE_V) == 0){
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      if(last - a == MEGAPGSIZE - PGSIZE)
+        break;
+      a += MEGAPGSIZE;
+      pa += MEGAPGSIZE;
+      continue;
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -165,30 +490,49 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never touched since sbrk()
+// have no mapping, and are skipped. A megapage must either
+// lie wholly inside the range or have been split already.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, pa, end = va + npages*PGSIZE;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
-    if(PTE_FLAGS(*pte) == PTE_V)
-      panic("uvmunmap: not a leaf");
+  for(a = va; a < end; a += PGSIZE){
+    if((pte = walkleaf(pagetable, a, &level)) == 0){
+      // a swapped-out page has a swap slot instead.
+      if((pte = walk(pagetable, a, 0)) != 0 && (*pte & PTE_SWAP)){
+        if(do_free)
+          swapfree(PTE2SLOT(*pte));
+        *pte = 0;
+      }
+      continue;
+    }
+    if(level > 0){
+      if(level > 1 || a % MEGAPGSIZE != 0 || a + MEGAPGSIZE > end)
+        panic("uvmunmap: megapage");
+      // each page of a megapage has its own reference count.
+      pa = PTE2PA(*pte);
+      if(do_free)
+        for(int i = 0; i < 512; i++)
+          kfree((void*)(pa + i*PGSIZE));
+      *pte = 0;
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
     if(do_free){
-      uint64 pa = PTE2PA(*pte);
+      pa = PTE2PA(*pte);
       kfree((void*)pa);
     }
     *pte = 0;
   }
+  tlbflush(pagetable, npages == 1 ? va : -1);
 }
 
 // create an empty user page table.
@@ -197,13 +541,35 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
+  kpgtype(pagetable, MEM_PAGETABLE);
   return pagetable;
 }
 
+// Free the pages of [va, va+npages*PGSIZE), va page-aligned, so
+// that touching them faults in new ones, first splitting any
+// megapage that straddles either end of the range.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmdiscard(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  uint64 edge[2] = { va, va + npages*PGSIZE };
+  pte_t *pte;
+  int level;
+
+  for(int i = 0; i < 2; i++){
+    if(edge[i] % MEGAPGSIZE == 0)
+      continue;
+    if((pte = walkleaf(pagetable, edge[i], &level)) != 0 && level > 0)
+      if(ptesplit(pte, level) != 0)
+        return -1;
+  }
+  uvmunmap(pagetable, va, npages, 1);
+  return 0;
+}
+
 // Load the user initcode into address 0 of pagetable,
 // for the very first process.
 // sz must be less than a page.
@@ -214,8 +580,8 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
+  kpgtype(mem, MEM_USER);
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -233,12 +599,12 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
+    kpgtype(mem, MEM_USER);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -251,14 +617,20 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if a
+// megapage that straddles newsz can't be split.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
+  int level;
+
   if(newsz >= oldsz)
     return oldsz;
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
+    if(walkleaf(pagetable, PGROUNDUP(newsz), &level) && level > 0 &&
+       walk(pagetable, PGROUNDUP(newsz), 0) == 0)
+      return oldsz;
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
   }
@@ -286,6 +658,36 @@ freewalk(pagetable_t pagetable)
   kfree((void*)pagetable);
 }
 
+// Free the page-table pages under pagetable, at the given level,
+// except those on the way to va.
+static void
+freeexcept(pagetable_t pagetable, int level, uint64 va)
+{
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pagetable[i];
+    if((pte & PTE_V) == 0 || PTE_LEAF(pte))
+      continue;
+    if(i != PX(level, va)){
+      freewalk((pagetable_t)PTE2PA(pte));
+      pagetable[i] = 0;
+    } else if(level > 1){
+      freeexcept((pagetable_t)PTE2PA(pte), level - 1, va);
+    }
+  }
+}
+
+// Free user memory pages below sz, and every page-table page
+// but those that map the trampoline and trapframe, leaving
+// pagetable as proc_pagetable() made it, for another process.
+// Mappings above sz must already have been removed.
+void
+uvmstrip(pagetable_t pagetable, uint64 sz)
+{
+  if(sz > 0)
+    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+  freeexcept(pagetable, 2, TRAPFRAME);
+}
+
 // Free user memory pages,
 // then free page-table pages.
 void
@@ -297,52 +699,282 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 }
 
 // Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// its memory in [start, end) into a child's page table.
+// The child shares the parent's physical pages;
+// writable pages, other than MAP_SHARED ones,
+// become read-only copy-on-write pages in both,
+// and are copied by vmfault() when either process
+// first stores to them.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 start, uint64 end)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
+  int level;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  for(i = start; i < end; i += PGSIZE){
+    if((pte = walkleaf(old, i, &level)) == 0){
+      // not touched yet, and the child allocates its own,
+      // or swapped out, and the child shares the swap slot.
+      if((pte = walk(old, i, 0)) != 0 && (*pte & PTE_SWAP)){
+        if((npte = walk(new, i, 1)) == 0)
+          goto err;
+        swapdup(PTE2SLOT(*pte));
+        *npte = *pte;
+      }
+      continue;
+    }
+    if(level == 1 && i % MEGAPGSIZE == 0 && i + MEGAPGSIZE <= end){
+      // share the whole megapage.
+      if((npte = walklevel(new, i, 1, 1)) == 0)
+        goto err;
+      if(*npte & PTE_V)
+        panic("uvmcopy: remap");
+      if((*pte & PTE_W) && (*pte & PTE_SHARED) == 0)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      *npte = *pte;
+      pa = PTE2PA(*pte);
+      for(int k = 0; k < 512; k++)
+        kref((void*)(pa + k*PGSIZE));
+      i += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    if(level > 0 && (pte = walk(old, i, 0)) == 0)
+      goto err;
+    if((*pte & PTE_W) && (*pte & PTE_SHARED) == 0)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    kref((void*)pa);
   }
+  // the parent's writable pages are now read-only.
+  tlbflush(old, -1);
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  tlbflush(old, -1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
-// mark a PTE invalid for user access.
-// used by exec for the user stack guard page.
+// Allocate a page for user memory, zeroed if zero is set.
+// User memory leaves the last WMARK_MIN free pages to the
+// kernel; below that, reclaim the caches' pages, then swap
+// pages out, and then kill the biggest process and wait for
+// it to go. The caller must not hold on to any of its own
+// pages that swapout() could take.
+// Returns 0 if there is no memory to be had.
+void*
+uvmkalloc(int zero)
+{
+  void *mem;
+  int waits = 0;
+
+  for(;;){
+    if(kfreepages() > WMARK_MIN && (mem = zero ? kalloc_zeroed() : kalloc()) != 0){
+      kpgtype(mem, MEM_USER);
+      return mem;
+    }
+    if(kreclaim() > 0 || swapout() == 0)
+      continue;
+    if(waits++ >= OOMWAIT || oomkill() != 0)
+      return 0;
+  }
+}
+
+// Flush p's TLB entries and walk cache for the page at va, or
+// for all its pages if va is -1, after changing p's page table,
+// which p may or may not be the current process.
 void
-uvmclear(pagetable_t pagetable, uint64 va)
+uvmflush(struct proc *p, uint64 va)
+{
+  if(p == myproc())
+    tlbflush(p->pagetable, va);
+  else
+    asidinval(p);
+}
+
+// Look for a page of p's to swap out, sweeping p's page table
+// from p->swaphand like the hand of a clock: pass over pages
+// used since the last sweep, clearing their PTE_A, and return
+// the PTE of the first one that wasn't, leaving the hand just
+// past it. Only private pages qualify, and an unused megapage
+// is split to get at its pages. Returns 0 at the end of the
+// address space, where the hand starts over. The caller holds
+// p->lock, and p is either not running or the current process.
+pte_t*
+uvmclock(struct proc *p)
+{
+  uint64 va = p->swaphand;
+  pte_t *pte, *victim = 0;
+  int cleared = 0;
+
+  while(victim == 0 && va < TRAPFRAME){
+    pte = &p->pagetable[PX(2, va)];
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+      va = (va | ((1L << PXSHIFT(2)) - 1)) + 1;
+      continue;
+    }
+    pte = &((pagetable_t)PTE2PA(*pte))[PX(1, va)];
+    if((*pte & PTE_V) && PTE_LEAF(*pte) && (*pte & PTE_U) &&
+       (*pte & PTE_SHARED) == 0 && krefcnt((void*)PTE2PA(*pte)) == 1){
+      if((*pte & PTE_A) || ptesplit(pte, 1) != 0){
+        *pte &= ~PTE_A;
+        cleared = 1;
+      }
+    }
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+      va = (va | (MEGAPGSIZE - 1)) + 1;
+      continue;
+    }
+    pte = &((pagetable_t)PTE2PA(*pte))[PX(0, va)];
+    va += PGSIZE;
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || (*pte & PTE_SHARED) ||
+       krefcnt((void*)PTE2PA(*pte)) != 1)
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      cleared = 1;
+      continue;
+    }
+    victim = pte;
+  }
+
+  p->swaphand = va < TRAPFRAME ? va : 0;
+  // so that the hardware sets PTE_A again.
+  if(cleared)
+    uvmflush(p, -1);
+  return victim;
+}
+
+// Map a zeroed megapage for the first touch of the 2-megabyte
+// block of p's heap that holds va, if all of the block is below
+// p->sz, none of it is mapped or part of a program segment,
+// and a physically contiguous block is free without going
+// below WMARK_LOW. Returns 0 on success, -1 if the caller should
+// map a single page.
+static int
+megafault(struct proc *p, uint64 va)
 {
+  uint64 base = va & ~(uint64)(MEGAPGSIZE - 1);
+  struct vma *v;
   pte_t *pte;
-  
-  pte = walk(pagetable, va, 0);
-  if(pte == 0)
-    panic("uvmclear");
-  *pte &= ~PTE_U;
+  char *mem;
+
+  if(base + MEGAPGSIZE > p->sz)
+    return -1;
+  for(v = p->vma; v < p->vma + NVMA; v++)
+    if(v->end != 0 && v->start < base + MEGAPGSIZE && v->end > base)
+      return -1;
+  if((pte = walklevel(p->pagetable, base, 1, 1)) == 0 || (*pte & PTE_V))
+    return -1;
+  if(kfreepages() < WMARK_LOW + (1 << MEGAORDER) ||
+     (mem = kalloc_pages(MEGAORDER)) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++)
+    kpgtype(mem + i*PGSIZE, MEM_USER);
+  memset(mem, 0, MEGAPGSIZE);
+  *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_V;
+  p->ru.minflt++;
+  return 0;
+}
+
+// Handle a page fault at user virtual address va in pagetable,
+// which must be the current process's, for a store if write is
+// set. The first touch of a page of a program segment or mmap()
+// region is handled by vmafault(); the first touch of any other
+// page below p->sz gets a fresh zeroed page, or a whole zeroed
+// megapage if it can. A store to a clean
+// MAP_SHARED page marks it dirty. A store to a copy-on-write
+// page gets the page to itself, copying it if it is still shared.
+// Returns 0 if the faulting access can be retried, -1 if it is
+// a real fault.
+int
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+  int level;
+
+  if(va >= MAXVA || p == 0 || pagetable != p->pagetable)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walkleaf(pagetable, va, &level);
+  if(pte == 0){
+    // the TLB may remember that va was unmapped, so flush
+    // it once va is mapped.
+    if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_SWAP)){
+      if(swapin(pte) != 0)
+        return -1;
+      tlbflush(pagetable, va);
+      return 0;
+    }
+    if((v = vmalookup(p, va)) != 0){
+      if(vmafault(v, va, write) != 0)
+        return -1;
+      tlbflush(pagetable, va);
+      return 0;
+    }
+    if(va >= p->sz)
+      return -1;
+    if(megafault(p, va) == 0){
+      tlbflush(pagetable, -1);
+      return 0;
+    }
+    if((mem = uvmkalloc(1)) == 0)
+      return -1;
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+      kfree(mem);
+      return -1;
+    }
+    tlbflush(pagetable, va);
+    p->ru.minflt++;
+    return 0;
+  }
+  if((*pte & PTE_U) == 0 || !write)
+    return -1;
+  if((*pte & PTE_SHARED) && (*pte & PTE_W) == 0){
+    if((v = vmalookup(p, va)) == 0 || (v->prot & PTE_W) == 0)
+      return -1;
+    *pte |= PTE_W | PTE_D;
+    tlbflush(pagetable, va);
+    p->ru.minflt++;
+    return 0;
+  }
+  if((*pte & PTE_COW) == 0)
+    return -1;
+  // copy just the page that was stored to.
+  if(level > 0 && (pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+
+  pa = PTE2PA(*pte);
+  if(krefcnt((void*)pa) > 1){
+    // hold on to pa, lest the other sharers go away and
+    // swapout() takes it while uvmkalloc() waits for memory.
+    kref((void*)pa);
+    if((mem = uvmkalloc(0)) != 0){
+      memmove(mem, (char*)pa, PGSIZE);
+      *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+      kfree((void*)pa);
+    }
+    kfree((void*)pa);
+    if(mem == 0)
+      return -1;
+  } else {
+    // every other sharer has already copied or exited.
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+  }
+  tlbflush(pagetable, va);
+  p->ru.minflt++;
+  return 0;
 }
 
 // Copy from kernel to user.
@@ -352,12 +984,27 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t pte;
+
+#ifdef SUMCOPY
+  push_off();
+  int r = uwinopen(pagetable, dstva, len) == 0 ? ucopy((void*)(UWINDOW + dstva), src, len) : -1;
+  pop_off();
+  if(r == 0)
+    return 0;
+#endif
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    pte = uvmlookup(pagetable, va0);
+    if((pte & PTE_W) == 0){
+      if(vmfault(pagetable, va0, 1) != 0)
+        return -1;
+      pte = uvmlookup(pagetable, va0);
+    }
+    if((pte & PTE_U) == 0)
       return -1;
+    pa0 = PTE2PA(pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -378,11 +1025,22 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+#ifdef SUMCOPY
+  push_off();
+  int r = uwinopen(pagetable, srcva, len) == 0 ? ucopy(dst, (void*)(UWINDOW + srcva), len) : -1;
+  pop_off();
+  if(r == 0)
+    return 0;
+#endif
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(vmfault(pagetable, va0, 0) != 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -405,11 +1063,24 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+#ifdef SUMCOPY
+  push_off();
+  int r = uwinopen(pagetable, srcva, max) == 0 ? ucopystr(dst, (char*)(UWINDOW + srcva), max) : -1;
+  pop_off();
+  if(r == 0)
+    return 0;
+  if(r == 1)
+    return -1;  // no '\0' within max
+#endif
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(vmfault(pagetable, va0, 0) != 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
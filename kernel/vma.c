@@ -0,0 +1,455 @@
+//
+// Demand-paged regions of a process's address space.
+//
+// exec() describes each program segment with a struct vma
+// instead of reading it in, and mmap() adds regions for files,
+// anonymous memory and shared-memory segments above the heap.
+// vmfault() calls vmafault() to fill in a page of a region the
+// first time it is touched, sharing whole pages of a file
+// through the page cache.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "mman.h"
+
+// Find the region of p's address space that contains va.
+// Program segments end at p->sz if sbrk() has shrunk p.
+struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->end == 0 || va < v->start || va >= v->end)
+      continue;
+    if((v->flags & VMA_MMAP) == 0 && va >= p->sz)
+      continue;
+    return v;
+  }
+  return 0;
+}
+
+// The lowest address of p's mmap() regions, which the heap
+// may not grow past.
+uint64
+vmabase(struct proc *p)
+{
+  uint64 base = TRAPFRAME;
+
+  for(struct vma *v = p->vma; v < p->vma + NVMA; v++)
+    if(v->end != 0 && (v->flags & VMA_MMAP) && v->start < base)
+      base = v->start;
+  return base;
+}
+
+// Give the child np its own references to p's regions, and
+// the pages p has faulted in of its mmap() regions; uvmcopy()
+// has already done the ones below p->sz.
+// Returns 0 on success, -1 on failure.
+int
+vmacopy(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->end == 0 || (v->flags & VMA_MMAP) == 0)
+      continue;
+    if(uvmcopy(p->pagetable, np->pagetable, v->start, v->end) < 0){
+      while(v-- > p->vma)
+        if(v->end != 0 && (v->flags & VMA_MMAP))
+          uvmunmap(np->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+      return -1;
+    }
+  }
+
+  for(int i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(np->vma[i].ip)
+      np->vma[i].ip = idup(np->vma[i].ip);
+    if(np->vma[i].shm)
+      shmdup(np->vma[i].shm);
+  }
+  return 0;
+}
+
+// Write the page at va, which pagetable maps to pa, back to
+// region v's file. Stores past the end of the file are lost.
+static void
+writeback(struct vma *v, uint64 va, uint64 pa)
+{
+  uint off = v->off + (va - v->start);
+  uint n;
+
+  begin_op();
+  ilock(v->ip);
+  if(off < v->ip->size){
+    n = v->ip->size - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    writei(v->ip, 0, pa, off, n);
+  }
+  iunlock(v->ip);
+  end_op();
+}
+
+// Write the dirty pages in [start, end) of region v back to its
+// file, if it is a writable MAP_SHARED file mapping.
+static void
+vmasync(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  pte_t *pte;
+
+  if((v->flags & VMA_SHARED) && v->ip && (v->prot & PTE_W)){
+    for(uint64 va = start; va < end; va += PGSIZE){
+      pte = walk(pagetable, va, 0);
+      if(pte && (*pte & PTE_V) && (*pte & PTE_D))
+        writeback(v, va, PTE2PA(*pte));
+    }
+  }
+}
+
+// Unmap [start, end) of region v from pagetable, first writing
+// the dirty pages of a MAP_SHARED file mapping back to the file.
+static void
+vmaunmap(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  vmasync(pagetable, v, start, end);
+  uvmunmap(pagetable, start, (end - start) / PGSIZE, 1);
+}
+
+// Drop the file references held by an array of NVMA regions
+// and clear them, unmapping their mmap() regions from pagetable
+// if it is not 0. The pages of program segments are left to
+// uvmfree().
+void
+vmaclear(pagetable_t pagetable, struct vma *vma)
+{
+  for(int i = 0; i < NVMA; i++){
+    if(vma[i].end != 0 && (vma[i].flags & VMA_MMAP) && pagetable)
+      vmaunmap(pagetable, &vma[i], vma[i].start, vma[i].end);
+    if(vma[i].ip){
+      begin_op();
+      iput(vma[i].ip);
+      end_op();
+    }
+    if(vma[i].shm)
+      shmput(vma[i].shm);
+    memset(&vma[i], 0, sizeof(vma[i]));
+  }
+}
+
+// Forget the parts of p's program segments at or above sz, after
+// sbrk() has shrunk p, so that growing p again gives it
+// zeroed memory there rather than the file's contents.
+void
+vmatrim(struct proc *p, uint64 sz)
+{
+  struct vma *v;
+
+  sz = PGROUNDUP(sz);
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->end == 0 || v->end <= sz || (v->flags & VMA_MMAP))
+      continue;
+    if(v->start < sz){
+      v->end = sz;
+      continue;
+    }
+    if(v->ip){
+      begin_op();
+      iput(v->ip);
+      end_op();
+    }
+    memset(v, 0, sizeof(*v));
+  }
+}
+
+// Map len bytes of ip starting at off, which must be page-aligned,
+// or of zeroes if ip is 0, into the current process at the highest
+// free addresses below the trapframe. prot and flags are PROT_* and
+// MAP_*. Pages are faulted in on first touch.
+// Returns the address, or -1 on failure.
+uint64
+mmap(uint64 len, int prot, int flags, struct inode *ip, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *o, *nv = 0;
+  uint64 lo, hi;
+
+  if(len == 0 || len > TRAPFRAME)
+    return -1;
+  len = PGROUNDUP(len);
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->end == 0){
+      nv = v;
+      break;
+    }
+  }
+  if(nv == 0)
+    return -1;
+
+  // move down past each mmap() region in the way.
+  hi = TRAPFRAME;
+  for(;;){
+    if(hi < len || hi - len < PGROUNDUP(p->sz))
+      return -1;
+    lo = hi - len;
+    o = 0;
+    for(v = p->vma; v < p->vma + NVMA; v++)
+      if(v->end != 0 && (v->flags & VMA_MMAP) && v->start < hi && v->end > lo)
+        if(o == 0 || v->start < o->start)
+          o = v;
+    if(o == 0)
+      break;
+    hi = o->start;
+  }
+
+  nv->start = lo;
+  nv->end = hi;
+  nv->prot = 0;
+  if(prot & PROT_READ)
+    nv->prot |= PTE_R;
+  if(prot & PROT_WRITE)
+    nv->prot |= PTE_R | PTE_W;
+  if(prot & PROT_EXEC)
+    nv->prot |= PTE_X;
+  nv->flags = VMA_MMAP;
+  if(flags & MAP_SHARED)
+    nv->flags |= VMA_SHARED;
+  nv->ip = ip ? idup(ip) : 0;
+  nv->shm = 0;
+  nv->off = off;
+  nv->filesz = ip ? len : 0;
+  return lo;
+}
+
+// Map all of shared-memory segment id into the current process,
+// readable and writable. Returns the address, or -1 on failure.
+uint64
+shmmap(int id)
+{
+  struct shm *sh;
+  uint64 size, va;
+
+  if((sh = shmget(id, &size)) == 0)
+    return -1;
+  if((va = mmap(size, PROT_READ|PROT_WRITE, MAP_SHARED, 0, 0)) == -1){
+    shmput(sh);
+    return -1;
+  }
+  vmalookup(myproc(), va)->shm = sh;
+  return va;
+}
+
+// Remove the current process's mmap() mappings in [addr, addr+len),
+// writing dirty MAP_SHARED pages back to their files. addr must be
+// page-aligned. Returns 0 on success, -1 on failure.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv = 0;
+  uint64 end, lo, hi;
+  int split = 0;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr || addr + len > TRAPFRAME)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  // unmapping the middle of a region needs a slot for its top part.
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->end == 0)
+      nv = v;
+    else if((v->flags & VMA_MMAP) && addr > v->start && end < v->end)
+      split = 1;
+  }
+  if(split && nv == 0)
+    return -1;
+
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->end == 0 || (v->flags & VMA_MMAP) == 0 || v->end <= addr || v->start >= end)
+      continue;
+    lo = addr > v->start ? addr : v->start;
+    hi = end < v->end ? end : v->end;
+    vmaunmap(p->pagetable, v, lo, hi);
+
+    if(lo == v->start && hi == v->end){
+      if(v->ip){
+        begin_op();
+        iput(v->ip);
+        end_op();
+      }
+      if(v->shm)
+        shmput(v->shm);
+      memset(v, 0, sizeof(*v));
+      continue;
+    }
+    if(lo > v->start && hi < v->end){
+      *nv = *v;
+      if(nv->ip)
+        nv->ip = idup(nv->ip);
+      if(nv->shm)
+        shmdup(nv->shm);
+      v->end = lo;
+      v = nv;
+      lo = v->start;
+    }
+    if(lo == v->start){
+      v->off += hi - v->start;
+      v->start = hi;
+    } else {
+      v->end = lo;
+    }
+    if(v->ip)
+      v->filesz = v->end - v->start;
+  }
+  return 0;
+}
+
+// Tell the kernel how the current process will use its memory in
+// [addr, addr+len), which must be the heap or mmap() regions; addr
+// must be page-aligned. MADV_DONTNEED frees the pages at once:
+// touched again, they read as zeroes, or as the file's contents
+// for a file mapping, whose dirty MAP_SHARED pages are written
+// back first. Returns 0 on success, -1 on failure.
+int
+madvise(uint64 addr, uint64 len, int advice)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 end, va, next;
+
+  if(addr % PGSIZE != 0 || addr + len < addr || addr + len > TRAPFRAME)
+    return -1;
+  if(advice == MADV_NORMAL)
+    return 0;
+  if(advice != MADV_DONTNEED)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  for(va = addr; va < end; va = next){
+    v = vmalookup(p, va);
+    if(v && (v->flags & VMA_MMAP)){
+      next = end < v->end ? end : v->end;
+      vmasync(p->pagetable, v, va, next);
+    } else if(va < p->sz){
+      next = end < PGROUNDUP(p->sz) ? end : PGROUNDUP(p->sz);
+    } else {
+      return -1;
+    }
+    if(uvmdiscard(p->pagetable, va, (next - va) / PGSIZE) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Map the page at va, which lies in region v of the current
+// process, for a store if write is set, reading its contents
+// from the file. A page that is all file contents, and every
+// page of a MAP_SHARED file mapping, comes from the page cache.
+// Cached pages are shared read-only, or copy-on-write if the
+// region is private and writable; a MAP_SHARED page is mapped
+// writable only once it is stored to, so that its PTE_D bit
+// says whether munmap() has to write it back.
+// Returns 0 on success, -1 on failure.
+int
+vmafault(struct vma *v, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  uint64 n = 0;
+  uint off;
+  int perm, cache = 0, text = (v->flags & VMA_MMAP) == 0;
+  char *mem = 0, *fresh = 0;
+
+  va = PGROUNDDOWN(va);
+  if(v->prot == 0 || (write && (v->prot & PTE_W) == 0))
+    return -1;
+  perm = v->prot | PTE_U;
+  off = v->off + (va - v->start);
+
+  if(v->shm){
+    if((mem = shmpage(v->shm, off / PGSIZE)) == 0)
+      return -1;
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm | PTE_SHARED) != 0){
+      kfree(mem);
+      return -1;
+    }
+    p->ru.minflt++;
+    return 0;
+  }
+again:
+  if(v->ip && va - v->start < v->filesz){
+    n = v->filesz - (va - v->start);
+    if(n > PGSIZE)
+      n = PGSIZE;
+  }
+
+  if(n > 0){
+    ilock(v->ip);
+    if(v->flags & VMA_MMAP){
+      // mapped pages past the end of the file read as zero.
+      if(off >= v->ip->size)
+        n = 0;
+      else if(n > v->ip->size - off)
+        n = v->ip->size - off;
+    }
+    cache = n > 0 && off % PGSIZE == 0 && (n == PGSIZE || (v->flags & VMA_SHARED));
+    if(cache && (mem = pcacheget(v->ip, off, text)) != 0){
+      p->ru.minflt++;
+    } else if(n > 0){
+      if(fresh == 0){
+        // uvmkalloc() may wait for the OOM killer's victim, which
+        // may be faulting on this inode too, so not with it locked.
+        iunlock(v->ip);
+        if((fresh = uvmkalloc(0)) == 0)
+          return -1;
+        goto again;
+      }
+      mem = fresh;
+      fresh = 0;
+      if(readi(v->ip, 0, (uint64)mem, off, n) != n){
+        iunlock(v->ip);
+        kfree(mem);
+        return -1;
+      }
+      memset(mem + n, 0, PGSIZE - n);
+      if(cache)
+        pcacheadd(v->ip, off, mem, text);
+      p->ru.majflt++;
+    }
+    iunlock(v->ip);
+    if(fresh)
+      kfree(fresh);
+  }
+
+  if(n == 0){
+    if((mem = uvmkalloc(1)) == 0)
+      return -1;
+    p->ru.minflt++;
+  }
+
+  if(v->flags & VMA_SHARED){
+    perm |= PTE_SHARED;
+    if(cache && !write)
+      perm &= ~PTE_W;
+    else if(cache)
+      perm |= PTE_D;
+  } else if(cache && (perm & PTE_W)){
+    perm = (perm & ~PTE_W) | PTE_COW;
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
@@ -110,6 +110,9 @@ main(int argc, char *argv[])
   for(i = 0; i < FSSIZE; i++)
     wsect(i, zeroes);
 
+  // make the image big enough for the kernel's swap area.
+  wsect(SWAPSTART + SWAPBLOCKS - 1, zeroes);
+
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
@@ -0,0 +1,58 @@
+// free: show how the kernel's physical memory is used, in
+// kilobytes, from the memstat() system call.
+//   free      totals, then the allocated pages by what they hold
+//   free -p   the same in pages
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fs.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+int pages;
+
+char *types[NMEMTYPE] = {
+  [MEM_OTHER]     "other",
+  [MEM_USER]      "user",
+  [MEM_PAGETABLE] "pagetable",
+  [MEM_KSTACK]    "kstack",
+  [MEM_SLAB]      "slab",
+};
+
+void
+show(char *name, uint64 npages)
+{
+  if(pages)
+    printf("%s\t%d\n", name, (int)npages);
+  else
+    printf("%s\t%d KB\n", name, (int)(npages * PGSIZE / 1024));
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat ms;
+  uint64 used = 0;
+
+  if(argc > 1 && strcmp(argv[1], "-p") == 0)
+    pages = 1;
+  if(memstat(&ms) < 0){
+    fprintf(2, "free: memstat failed\n");
+    exit(1);
+  }
+  for(int t = 0; t < NMEMTYPE; t++)
+    used += ms.used[t];
+
+  show("total", ms.total);
+  show("used", used);
+  show("free", ms.free);
+  show("zeroed", ms.zeroed);
+  for(int t = 0; t < NMEMTYPE; t++)
+    show(types[t], ms.used[t]);
+  show("pcache", ms.pcache);
+  show("swap", ms.swaptotal);
+  show("swapped", ms.swapused);
+  printf("bcache\t%d buffers (%d KB)\n", (int)ms.nbuf, (int)(ms.nbuf * BSIZE / 1024));
+  printf("pipes\t%d\n", (int)ms.npipe);
+  exit(0);
+}
@@ -0,0 +1,189 @@
+// mallocbench: compare malloc() and free() from umalloc.c with
+// the K&R first-fit allocator that umalloc.c used to be, in
+// thousands of operations per second of this process's CPU time:
+//   pairs  malloc() and at once free() 32 bytes
+//   pool   replace a random one of POOL live blocks of 8 to 1024 bytes
+//   large  malloc() and free() 64 KB
+
+#include "kernel/types.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+#define NPAIRS 200000
+#define POOL   1000
+#define NPOOL  100000
+#define NLARGE 1000
+
+// The K&R allocator, from The C Programming Language, 2nd ed.,
+// Section 8.7, as umalloc.c had it.
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+
+void
+kr_free(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+static Header*
+morecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  kr_free((void*)(hp + 1));
+  return freep;
+}
+
+void*
+kr_malloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = morecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+struct allocator {
+  char *name;
+  void *(*malloc)(uint);
+  void (*free)(void*);
+} allocators[] = {
+  { "k&r", kr_malloc, kr_free },
+  { "umalloc", malloc, free },
+};
+
+void *pool[POOL];
+uint seed = 1;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+uint64
+cputime(void)
+{
+  struct rusage ru;
+
+  if(getrusage(RUSAGE_SELF, &ru) < 0){
+    fprintf(2, "mallocbench: getrusage failed\n");
+    exit(1);
+  }
+  return ru.utime + ru.stime;
+}
+
+void
+report(char *alloc, char *name, uint64 ops, uint64 cycles)
+{
+  if(cycles == 0)
+    cycles = 1;
+  printf("%s\t%s\t%d kops/s\n", alloc, name, (int)(ops * TIMEBASE_HZ / cycles / 1000));
+}
+
+void*
+xmalloc(struct allocator *a, uint n)
+{
+  void *p;
+
+  if((p = a->malloc(n)) == 0){
+    fprintf(2, "mallocbench: %s: out of memory\n", a->name);
+    exit(1);
+  }
+  return p;
+}
+
+void
+bench(struct allocator *a)
+{
+  uint64 t0;
+
+  t0 = cputime();
+  for(int i = 0; i < NPAIRS; i++)
+    a->free(xmalloc(a, 32));
+  report(a->name, "pairs", 2L * NPAIRS, cputime() - t0);
+
+  seed = 1;
+  t0 = cputime();
+  for(int i = 0; i < POOL; i++)
+    pool[i] = xmalloc(a, 8 + rand() % 1017);
+  for(int i = 0; i < NPOOL; i++){
+    int j = rand() % POOL;
+    a->free(pool[j]);
+    pool[j] = xmalloc(a, 8 + rand() % 1017);
+  }
+  for(int i = 0; i < POOL; i++)
+    a->free(pool[i]);
+  report(a->name, "pool", 2L * (POOL + NPOOL), cputime() - t0);
+
+  t0 = cputime();
+  for(int i = 0; i < NLARGE; i++)
+    a->free(xmalloc(a, 64*1024));
+  report(a->name, "large", 2L * NLARGE, cputime() - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  for(int i = 0; i < sizeof(allocators)/sizeof(allocators[0]); i++)
+    bench(&allocators[i]);
+  exit(0);
+}
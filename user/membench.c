@@ -0,0 +1,120 @@
+// membench: measure how fast the kernel moves memory, in
+// megabytes per second of this process's CPU time:
+//   pipe  write() and read() back 512 bytes, a pipe's worth
+//   read  read() a file that sits in the buffer cache
+//   sbrk  grow the heap and touch each page, which the kernel zeroes
+// run it on kernels with and without a change to string.c.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+#define CHUNK 4096
+#define PIPECHUNK 512   // a full pipe
+#define TOTAL (32*1024*1024)
+#define FILESZ (16*1024)
+
+char buf[CHUNK];
+
+uint64
+cputime(void)
+{
+  struct rusage ru;
+
+  if(getrusage(RUSAGE_SELF, &ru) < 0){
+    fprintf(2, "membench: getrusage failed\n");
+    exit(1);
+  }
+  return ru.utime + ru.stime;
+}
+
+void
+report(char *name, uint64 bytes, uint64 cycles)
+{
+  if(cycles == 0)
+    cycles = 1;
+  printf("%s\t%l MB/s\n", name, bytes * TIMEBASE_HZ / cycles / (1024*1024));
+}
+
+void
+pipebench(void)
+{
+  int fds[2];
+  uint64 t0;
+
+  if(pipe(fds) < 0){
+    fprintf(2, "membench: pipe failed\n");
+    exit(1);
+  }
+  t0 = cputime();
+  for(int n = 0; n < TOTAL; n += PIPECHUNK){
+    if(write(fds[1], buf, PIPECHUNK) != PIPECHUNK ||
+       read(fds[0], buf, PIPECHUNK) != PIPECHUNK){
+      fprintf(2, "membench: pipe i/o failed\n");
+      exit(1);
+    }
+  }
+  report("pipe", 2L * TOTAL, cputime() - t0);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void
+readbench(void)
+{
+  int fd;
+  uint64 t0;
+
+  if((fd = open("membench.tmp", O_CREATE|O_RDWR)) < 0){
+    fprintf(2, "membench: create failed\n");
+    exit(1);
+  }
+  for(int n = 0; n < FILESZ; n += CHUNK)
+    write(fd, buf, CHUNK);
+  close(fd);
+
+  t0 = cputime();
+  for(int i = 0; i < TOTAL / FILESZ; i++){
+    if((fd = open("membench.tmp", O_RDONLY)) < 0){
+      fprintf(2, "membench: open failed\n");
+      exit(1);
+    }
+    while(read(fd, buf, CHUNK) > 0)
+      ;
+    close(fd);
+  }
+  report("read", TOTAL, cputime() - t0);
+  unlink("membench.tmp");
+}
+
+void
+sbrkbench(void)
+{
+  int size = 4*1024*1024;
+  uint64 t0, total = 0;
+  char *p;
+
+  t0 = cputime();
+  while(total < TOTAL){
+    if((p = sbrk(size)) == (char*)-1){
+      fprintf(2, "membench: sbrk failed\n");
+      exit(1);
+    }
+    for(int i = 0; i < size; i += CHUNK)
+      p[i] = 1;
+    sbrk(-size);
+    total += size;
+  }
+  report("sbrk", total, cputime() - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  memset(buf, 'x', CHUNK);
+  pipebench();
+  readbench();
+  sbrkbench();
+  exit(0);
+}
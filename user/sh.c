@@ -1,6 +1,7 @@
 // Shell.
 
 #include "kernel/types.h"
+#include "kernel/param.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
 
@@ -52,13 +53,63 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+struct cmd *parsesimple(char*);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
+int nofds[3] = { -1, -1, -1 };
+
+// Start cmd in a child process whose file descriptors 0, 1 and 2
+// are fds[0..2], or the shell's own where fds[i] is -1. A command,
+// with or without redirections, is started with spawn(), which
+// doesn't copy the shell's memory; anything else runs in a copy
+// of the shell. Returns the child's pid, or -1.
+int
+spawncmd(struct cmd *cmd, int *fds)
+{
+  struct execcmd *ecmd;
+  struct redircmd *rcmd;
+  int f[3], fd, pid;
+
+  if(cmd->type == EXEC && ((struct execcmd*)cmd)->argv[0]){
+    ecmd = (struct execcmd*)cmd;
+    if((pid = spawn(ecmd->argv[0], ecmd->argv, fds)) < 0)
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+    return pid;
+  }
+
+  if(cmd->type == REDIR){
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return -1;
+    }
+    memmove(f, fds, sizeof(f));
+    f[rcmd->fd] = fd;
+    pid = spawncmd(rcmd->cmd, f);
+    close(fd);
+    return pid;
+  }
+
+  if((pid = fork1()) == 0){
+    for(fd = 0; fd < 3; fd++){
+      if(fds[fd] >= 0){
+        close(fd);
+        dup(fds[fd]);
+      }
+    }
+    // such as the other end of a pipe.
+    for(fd = 3; fd < NOFILE; fd++)
+      close(fd);
+    runcmd(cmd);
+  }
+  return pid;
+}
+
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
 {
-  int p[2];
+  int p[2], fds[3], n;
   struct backcmd *bcmd;
   struct execcmd *ecmd;
   struct listcmd *lcmd;
@@ -92,9 +143,8 @@ runcmd(struct cmd *cmd)
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(lcmd->left);
-    wait(0);
+    if(spawncmd(lcmd->left, nofds) > 0)
+      wait(0);
     runcmd(lcmd->right);
     break;
 
@@ -102,30 +152,25 @@ runcmd(struct cmd *cmd)
     pcmd = (struct pipecmd*)cmd;
     if(pipe(p) < 0)
       panic("pipe");
-    if(fork1() == 0){
-      close(1);
-      dup(p[1]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->left);
-    }
-    if(fork1() == 0){
-      close(0);
-      dup(p[0]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->right);
-    }
+    n = 0;
+    fds[0] = -1;
+    fds[1] = p[1];
+    fds[2] = -1;
+    if(spawncmd(pcmd->left, fds) > 0)
+      n++;
+    fds[0] = p[0];
+    fds[1] = -1;
+    if(spawncmd(pcmd->right, fds) > 0)
+      n++;
     close(p[0]);
     close(p[1]);
-    wait(0);
-    wait(0);
+    while(n-- > 0)
+      wait(0);
     break;
 
   case BACK:
     bcmd = (struct backcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(bcmd->cmd);
+    spawncmd(bcmd->cmd, nofds);
     break;
   }
   exit(0);
@@ -146,6 +191,7 @@ int
 main(void)
 {
   static char buf[100];
+  struct cmd *cmd;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -165,6 +211,13 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    // a plain command needs no copy of the shell.
+    if((cmd = parsesimple(buf)) != 0){
+      if(spawncmd(cmd, nofds) > 0)
+        wait(0);
+      free(cmd);
+      continue;
+    }
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait(0);
@@ -342,6 +395,37 @@ parsecmd(char *s)
   return cmd;
 }
 
+// Parse a line that is just a command and its arguments, none of
+// the symbols, which the shell can do itself since such a line
+// can't fail to parse. Returns 0 for any other line.
+struct cmd*
+parsesimple(char *s)
+{
+  char *es, *q, *eq;
+  struct execcmd *cmd;
+  int argc = 0;
+
+  for(es = s; *es; es++)
+    if(strchr(symbols, *es))
+      return 0;
+  cmd = (struct execcmd*)execcmd();
+  while(gettoken(&s, es, &q, &eq) == 'a'){
+    if(argc >= MAXARGS - 1){
+      free(cmd);
+      return 0;
+    }
+    cmd->argv[argc] = q;
+    cmd->eargv[argc] = eq;
+    argc++;
+  }
+  if(argc == 0){
+    free(cmd);
+    return 0;
+  }
+  nulterminate((struct cmd*)cmd);
+  return (struct cmd*)cmd;
+}
+
 struct cmd*
 parseline(char **ps, char *es)
 {
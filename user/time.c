@@ -0,0 +1,52 @@
+#include "kernel/types.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+// print a time-CSR cycle count as seconds with three decimals.
+void
+printsecs(char *label, uint64 cycles)
+{
+  uint64 ms = cycles / (TIMEBASE_HZ / 1000);
+
+  printf("%s %d.%d%d%ds\n", label, (int)(ms / 1000),
+         (int)(ms / 100 % 10), (int)(ms / 10 % 10), (int)(ms % 10));
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct rusage ru;
+  int pid, status, t0, t1;
+
+  if(argc < 2){
+    fprintf(2, "usage: time command [args...]\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "time: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "time: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  if(wait4(pid, &status, &ru) < 0){
+    fprintf(2, "time: wait4 failed\n");
+    exit(1);
+  }
+  t1 = uptime();
+
+  // clock ticks arrive about ten times a second.
+  printsecs("real", (uint64)(t1 - t0) * (TIMEBASE_HZ / 10));
+  printsecs("user", ru.utime);
+  printsecs("sys ", ru.stime);
+  printf("switches %d voluntary, %d involuntary\n", ru.nvcsw, ru.nivcsw);
+  printf("blocks   %d in, %d out\n", ru.inblock, ru.oublock);
+  printf("faults   %d minor, %d major\n", ru.minflt, ru.majflt);
+
+  exit(status);
+}
@@ -2,89 +2,184 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/mman.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with segregated size classes.
+//
+// A request of up to MAXSMALL bytes, plus its header, is rounded
+// up to a power of two from MINSIZE and comes off the free list
+// of that size class, so malloc() and free() take constant time.
+// An empty list is refilled by carving a CHUNK from sbrk() into
+// blocks of its class; freed blocks go back on their class's
+// list and are never merged. Once a class of blocks of TRIMSIZE
+// or more holds TRIMFREE bytes that still have their pages, free()
+// hands the whole pages of all but the first TRIMKEEP bytes of its
+// list back to the kernel with madvise(), and moves those blocks
+// to a list of trimmed blocks, which malloc() uses only when the
+// other is empty; their pages come back zeroed. A loop that
+// mallocs and frees the same few blocks never trims, and no block
+// is trimmed twice between uses.
+//
+// Anything bigger gets a region of its own from mmap(), which
+// free() gives back with munmap().
+//
+// The free lists are kept in a struct cache, so that if user
+// processes get threads, each can have its own cache and only
+// go to a shared one when it runs dry.
+
+#define MINSHIFT 4
+#define MINSIZE  (1 << MINSHIFT)     // 16 bytes
+#define NCLASS   12                  // 16 bytes .. 32 KB
+#define MAXSMALL (MINSIZE << (NCLASS - 1))
+#define CHUNK    (16*1024)           // least sbrk() per refill
+#define LARGE    NCLASS              // class of an mmap() region
+#define TRIMSIZE (16*1024)           // least block free() trims
+#define TRIMFREE (128*1024)          // untrimmed free bytes before it does
+#define TRIMKEEP (64*1024)           // free bytes at a list's head it leaves
+#define PAGE     4096
 
 typedef long Align;
 
+// sits in front of every block; keeps what follows aligned.
 union header {
   struct {
-    union header *ptr;
-    uint size;
+    uint class;       // size class, or LARGE
+    uint64 size;      // bytes mapped, if LARGE
   } s;
-  Align x;
+  Align x[2];
 };
 
 typedef union header Header;
 
-static Header base;
-static Header *freep;
+struct block {
+  struct block *next;
+};
 
-void
-free(void *ap)
+struct cache {
+  struct block *free[NCLASS];      // blocks that still have their pages
+  struct block *trimmed[NCLASS];   // blocks trim() has given back
+  uint64 untrimmed[NCLASS];        // bytes on free[]
+};
+
+static struct cache cache;
+
+// Size class for an n-byte block, header included.
+static int
+sizeclass(uint64 n)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  int c = 0;
+
+  while((MINSIZE << c) < n)
+    c++;
+  return c;
 }
 
-static Header*
-morecore(uint nu)
+// Give class c's free list some blocks from sbrk().
+static int
+refill(struct cache *ca, int c)
 {
+  uint size = MINSIZE << c;
+  uint n = size < CHUNK ? CHUNK : size;
+  uint pad = -(uint64)sbrk(0) & (MINSIZE - 1);
   char *p;
-  Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
+  p = sbrk(pad + n);
   if(p == (char*)-1)
+    return -1;
+  p += pad;
+  for(uint i = n / size; i-- > 0; ){
+    struct block *b = (struct block*)(p + i*size);
+    b->next = ca->free[c];
+    ca->free[c] = b;
+  }
+  ca->untrimmed[c] += n / size * size;
+  return 0;
+}
+
+// Give back the whole pages of class c's free blocks past the
+// first TRIMKEEP bytes of its list, which malloc() will hand out
+// first, and move them to the trimmed list. Each block keeps the
+// page that holds its header and link.
+static void
+trim(struct cache *ca, int c)
+{
+  uint64 size = MINSIZE << c, kept = size;
+  struct block *last = ca->free[c], *b;
+
+  while(kept < TRIMKEEP && last->next){
+    last = last->next;
+    kept += size;
+  }
+  while((b = last->next) != 0){
+    last->next = b->next;
+    uint64 lo = ((uint64)((Header*)b + 1) + PAGE - 1) & ~(uint64)(PAGE - 1);
+    uint64 hi = ((uint64)b + size) & ~(uint64)(PAGE - 1);
+    if(lo < hi)
+      madvise((void*)lo, hi - lo, MADV_DONTNEED);
+    b->next = ca->trimmed[c];
+    ca->trimmed[c] = b;
+    ca->untrimmed[c] -= size;
+  }
+}
+
+static void*
+largealloc(uint64 n)
+{
+  Header *h;
+
+  n = (n + PAGE - 1) & ~(uint64)(PAGE - 1);
+  h = mmap(0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(h == MAP_FAILED)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  h->s.class = LARGE;
+  h->s.size = n;
+  return (void*)(h + 1);
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  uint64 n = (uint64)nbytes + sizeof(Header);
+  struct block *b;
+  Header *h;
+  int c;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
+  if(n > MAXSMALL)
+    return largealloc(n);
+  c = sizeclass(n);
+  if(cache.free[c] == 0 && cache.trimmed[c] == 0 && refill(&cache, c) < 0)
+    return 0;
+  if((b = cache.free[c]) != 0){
+    cache.free[c] = b->next;
+    cache.untrimmed[c] -= MINSIZE << c;
+  } else {
+    b = cache.trimmed[c];
+    cache.trimmed[c] = b->next;
   }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  h = (Header*)b;
+  h->s.class = c;
+  return (void*)(h + 1);
+}
+
+void
+free(void *ap)
+{
+  Header *h;
+  struct block *b;
+  int c;
+
+  if(ap == 0)
+    return;
+  h = (Header*)ap - 1;
+  c = h->s.class;
+  if(c == LARGE){
+    munmap(h, h->s.size);
+    return;
   }
+  b = (struct block*)h;
+  b->next = cache.free[c];
+  cache.free[c] = b;
+  cache.untrimmed[c] += MINSIZE << c;
+  if((MINSIZE << c) >= TRIMSIZE && cache.untrimmed[c] >= TRIMFREE)
+    trim(&cache, c);
 }
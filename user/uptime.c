@@ -0,0 +1,43 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/loadavg.h"
+#include "user/user.h"
+
+// print a FSHIFT fixed-point load average with two decimals.
+void
+printload(uint64 v)
+{
+  uint64 frac = ((v & (FIXED_1 - 1)) * 100) >> FSHIFT;
+
+  printf("%d.%d%d", (int)(v >> FSHIFT), (int)(frac / 10), (int)(frac % 10));
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct loadavg la;
+  int i;
+
+  if(getload(&la) < 0){
+    fprintf(2, "uptime: getload failed\n");
+    exit(1);
+  }
+
+  printf("up %d ticks, %d procs, %d running, %d runnable, load average: ",
+         la.ticks, la.nproc, la.nrunning, la.nrunnable);
+  for(i = 0; i < 3; i++){
+    printload(la.avg[i]);
+    printf(i < 2 ? ", " : "\n");
+  }
+
+  // with -c, also show how busy each CPU has been since boot.
+  if(argc > 1 && strcmp(argv[1], "-c") == 0){
+    for(i = 0; i < la.ncpu; i++){
+      uint64 total = la.cpu[i].busy + la.cpu[i].idle;
+      int pct = total ? (int)(la.cpu[i].busy * 100 / total) : 0;
+      printf("cpu%d: %d%% busy\n", i, pct);
+    }
+  }
+
+  exit(0);
+}
@@ -1,4 +1,7 @@
 struct stat;
+struct loadavg;
+struct memstat;
+struct rusage;
 
 // system calls
 int fork(void);
@@ -10,6 +13,7 @@ int read(int, void *, int);
 int close(int);
 int kill(int);
 int exec(const char *, char **);
+int spawn(const char *, char **, int *);
 int open(const char *, int);
 int mknod(const char *, short, short);
 int unlink(const char *);
@@ -30,6 +34,16 @@ int getswapcount(void);
 int nice(int new_nice);
 int startcfs(void);
 int stopcfs(void);
+int getload(struct loadavg *);
+int wait4(int pid, int *status, struct rusage *);
+int getrusage(int who, struct rusage *);
+void *mmap(void *addr, uint len, int prot, int flags, int fd, uint off);
+int munmap(void *addr, uint len);
+int madvise(void *addr, uint len, int advice);
+int shm_open(const char *name, int size);
+void *shm_map(int id);
+int shm_unlink(const char *name);
+int memstat(struct memstat *);
 
 // ulib.c
 int stat(const char *, struct stat *);
@@ -4,6 +4,8 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/mman.h"
+#include "kernel/memstat.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -1993,6 +1995,275 @@ forktest(char *s)
   }
 }
 
+// after fork, parent and child share their pages copy-on-write.
+// a store by either one must not be seen by the other, including
+// a store the kernel makes on the child's behalf with read().
+void
+cowfork(char *s)
+{
+  enum { NPG = 8 };
+  int i, pid, xstatus, fds[2];
+  char *a;
+
+  a = sbrk(NPG*4096);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NPG*4096; i += 4096)
+    a[i] = 'p';
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    for(i = 0; i < NPG*4096; i += 4096){
+      if(a[i] != 'p'){
+        printf("%s: child sees %x\n", s, a[i]);
+        exit(1);
+      }
+      // leave page 1 shared, for read() to copy.
+      if(i != 4096)
+        a[i] = 'c';
+    }
+    if(read(fds[0], a + 4096 + 1, 1) != 1 || a[4096 + 1] != 'k' || a[4096] != 'p')
+      exit(1);
+    exit(0);
+  }
+  close(fds[0]);
+  write(fds[1], "k", 1);
+  close(fds[1]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(i = 0; i < NPG*4096; i += 4096){
+    if(a[i] != 'p'){
+      printf("%s: parent sees child's store %x\n", s, a[i]);
+      exit(1);
+    }
+  }
+  if(a[4096 + 1] == 'k'){
+    printf("%s: parent sees child's read\n", s);
+    exit(1);
+  }
+  sbrk(-NPG*4096);
+}
+
+// mmap() a file shared and private, and anonymous memory shared
+// with a child.
+void
+mmaptest(char *s)
+{
+  enum { SZ = 3*4096 + 100 };
+  char *f = "mmapfile";
+  char *a, *b;
+  int fd, i, pid, xstatus;
+
+  unlink(f);
+  fd = open(f, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    char c = 'a' + i % 26;
+    if(write(fd, &c, 1) != 1){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+
+  a = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  b = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(a == MAP_FAILED || b == MAP_FAILED){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(a[i] != 'a' + i % 26 || b[i] != 'a' + i % 26){
+      printf("%s: wrong contents at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(a[SZ] != 0){
+    printf("%s: not zero past end of file\n", s);
+    exit(1);
+  }
+  b[0] = 'P';
+  a[1] = 'S';
+  a[SZ-1] = 'E';
+  if(a[0] != 'a' || b[0] != 'P'){
+    printf("%s: private and shared mappings mixed up\n", s);
+    exit(1);
+  }
+
+  // read() the file into a page of itself that isn't mapped yet.
+  char *c = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  int fd2 = open(f, O_RDONLY);
+  if(c == MAP_FAILED || fd2 < 0){
+    printf("%s: second mmap or open failed\n", s);
+    exit(1);
+  }
+  if(read(fd2, c, 100) != 100 || c[0] != 'a' || c[99] != 'a' + 99 % 26){
+    printf("%s: read into a mapping of the same file failed\n", s);
+    exit(1);
+  }
+  close(fd2);
+  munmap(c, 4096);
+
+  if(munmap(a, SZ) < 0 || munmap(b, SZ) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  char buf[2];
+  fd = open(f, O_RDONLY);
+  if(read(fd, buf, 2) != 2 || buf[0] != 'a' || buf[1] != 'S'){
+    printf("%s: shared store not written back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(f);
+
+  a = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(a == MAP_FAILED){
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  a[0] = 'x';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[0] = 'y';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[0] != 'y'){
+    printf("%s: child's store not shared\n", s);
+    exit(1);
+  }
+  munmap(a, 4096);
+
+  // a MAP_SHARED mapping of a program must still see write()s
+  // after the program has run.
+  struct stat st;
+  int n;
+  f = "mmapexec";
+  unlink(f);
+  if((fd = open("ls", O_RDONLY)) < 0 || (fd2 = open(f, O_CREATE|O_RDWR)) < 0){
+    printf("%s: open ls failed\n", s);
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    write(fd2, buf, n);
+  close(fd);
+  if(fstat(fd2, &st) < 0 || st.size == 0){
+    printf("%s: copy of ls failed\n", s);
+    exit(1);
+  }
+  close(fd2);
+  fd = open(f, O_RDWR);
+  a = mmap(0, st.size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(a == MAP_FAILED){
+    printf("%s: mmap of program failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < st.size; i += 4096)
+    (void)*(volatile char*)(a + i);   // fault the mapping in first
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    char *argv[] = { f, 0 };
+    close(1);
+    exec(f, argv);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: copy of ls failed to run\n", s);
+    exit(1);
+  }
+  for(i = 0; i < st.size; i += 4096){
+    n = st.size - i < 4096 ? st.size - i : 4096;
+    if(write(fd, "Z", 1) != 1 || write(fd, a + i + 1, n - 1) != n - 1){
+      printf("%s: rewrite of program failed\n", s);
+      exit(1);
+    }
+    if(a[i] != 'Z'){
+      printf("%s: shared mapping of a program missed a write\n", s);
+      exit(1);
+    }
+  }
+  munmap(a, st.size);
+  close(fd);
+  unlink(f);
+}
+
+// a child and its parent exchange data through a shared-memory
+// segment that each maps separately.
+void
+shmtest(char *s)
+{
+  enum { SZ = 16*4096 };
+  int id, i, pid, xstatus;
+  char *a;
+
+  shm_unlink("shmtest");
+  if((id = shm_open("shmtest", SZ)) < 0){
+    printf("%s: shm_open failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if((a = shm_map(shm_open("shmtest", 0))) == MAP_FAILED)
+      exit(1);
+    for(i = 0; i < SZ; i++)
+      a[i] = i % 251;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child failed\n", s);
+    exit(1);
+  }
+  if((a = shm_map(id)) == MAP_FAILED){
+    printf("%s: shm_map failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(a[i] != (char)(i % 251)){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(shm_unlink("shmtest") < 0 || munmap(a, SZ) < 0){
+    printf("%s: shm_unlink or munmap failed\n", s);
+    exit(1);
+  }
+  if(shm_map(id) != MAP_FAILED){
+    printf("%s: segment outlived its name and mappings\n", s);
+    exit(1);
+  }
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2554,8 +2825,89 @@ sbrk8000(char *s)
   *(top-1) = *(top-1) + 1;
 }
 
+// madvise(MADV_DONTNEED) should give heap pages back to the
+// kernel, and they should read as zero afterwards.
+void
+madvisetest(char *s)
+{
+  enum { N = 64 };
+  struct memstat before, after;
+  char *a, *top;
+
+  a = sbrk((N + 1) * PGSIZE);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char*)PGROUNDUP((uint64)a);
+  for(int i = 0; i < N; i++)
+    a[i*PGSIZE] = 1;
+
+  memstat(&before);
+  if(madvise(a, N*PGSIZE, MADV_DONTNEED) < 0){
+    printf("%s: madvise failed\n", s);
+    exit(1);
+  }
+  memstat(&after);
+  if(after.used[MEM_USER] + N/2 > before.used[MEM_USER]){
+    printf("%s: madvise freed %d pages, not %d\n", s,
+           (int)(before.used[MEM_USER] - after.used[MEM_USER]), N);
+    exit(1);
+  }
+  for(int i = 0; i < N; i++){
+    if(a[i*PGSIZE] != 0){
+      printf("%s: page %d not zero after madvise\n", s, i);
+      exit(1);
+    }
+  }
+
+  // memory the process doesn't have.
+  top = (char*)PGROUNDUP((uint64)sbrk(0));
+  if(madvise(top + PGSIZE, PGSIZE, MADV_DONTNEED) == 0){
+    printf("%s: madvise past the heap succeeded\n", s);
+    exit(1);
+  }
+}
 
 
+
+// spawn() a program with its output to a pipe, and fail to
+// spawn one that doesn't exist.
+void
+spawntest(char *s)
+{
+  char *argv[] = { "echo", "spawned", 0 };
+  int fds[3] = { -1, -1, -1 };
+  int p[2], pid, xstatus, n;
+  char buf[32];
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fds[1] = p[1];
+  if((pid = spawn("echo", argv, fds)) < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  close(p[1]);
+  n = read(p[0], buf, sizeof(buf) - 1);
+  close(p[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wrong wait\n", s);
+    exit(1);
+  }
+  if(n != 8 || memcmp(buf, "spawned\n", 8) != 0){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", argv, 0) >= 0){
+    printf("%s: spawn of a missing program succeeded\n", s);
+    exit(1);
+  }
+}
+
 // regression test. test whether exec() leaks memory if one of the
 // arguments is invalid. the test passes if the kernel doesn't panic.
 void
@@ -2618,6 +2970,9 @@ struct test {
   {dirfile, "dirfile"},
   {iref, "iref"},
   {forktest, "forktest"},
+  {cowfork, "cowfork"},
+  {mmaptest, "mmaptest"},
+  {shmtest, "shmtest"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
   {kernmem, "kernmem"},
@@ -2634,6 +2989,8 @@ struct test {
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
+  {madvisetest, "madvisetest"},
+  {spawntest, "spawntest"},
   {badarg, "badarg" },
 
   { 0, 0},
@@ -2924,6 +3281,69 @@ outofinodes(char *s)
   }
 }
 
+// use more memory than the machine has, so that the kernel
+// must page some of it out to swap and back in.
+void
+swaptest(char *s)
+{
+  int n = 128*1024*1024;
+  char *a;
+
+  a = sbrk(n);
+  if(a == (char*)-1){
+    printf("%s: sbrk(%d) failed\n", s, n);
+    exit(1);
+  }
+  for(int i = 0; i < n; i += PGSIZE)
+    *(int*)(a + i) = i;
+  for(int i = 0; i < n; i += PGSIZE){
+    if(*(int*)(a + i) != i){
+      printf("%s: wrong value at %d\n", s, i);
+      exit(1);
+    }
+  }
+  sbrk(-n);
+}
+
+// use more memory than memory and swap together hold; the
+// kernel should kill the process rather than fail elsewhere.
+void
+oomtest(char *s)
+{
+  int n = 256*1024*1024;
+  int pid, xstatus;
+  char *a;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a = sbrk(n);
+    if(a == (char*)-1)
+      exit(1);
+    for(int i = 0; i < n; i += PGSIZE)
+      a[i] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: child was not killed, status %d\n", s, xstatus);
+    exit(1);
+  }
+
+  // and there is memory again afterwards.
+  a = sbrk(1024*1024);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 1024*1024; i += PGSIZE)
+    a[i] = 1;
+  sbrk(-1024*1024);
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2931,6 +3351,8 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {swaptest, "swaptest"},
+  {oomtest, "oomtest"},
     
   { 0, 0},
 };
@@ -43,4 +43,15 @@ entry("getswapcount");
 # New system calls for assignment 3
 entry("nice");
 entry("startcfs");
-entry("stopcfs");
\ No newline at end of file
+entry("stopcfs");
+entry("getload");
+entry("wait4");
+entry("getrusage");
+entry("mmap");
+entry("munmap");
+entry("shm_open");
+entry("shm_map");
+entry("shm_unlink");
+entry("memstat");
+entry("madvise");
+entry("spawn");
\ No newline at end of file